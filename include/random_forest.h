@@ -7,15 +7,66 @@
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
 
 // Data structures
+
+// Per-feature quantization used by the histogram split search. Bin b holds
+// the values in (edges[b - 1], edges[b]]; the last edge is DBL_MAX, so every
+// value maps to a bin and a split after bin b uses edges[b] as threshold.
+typedef struct {
+    double **edges;
+    int *n_bins;
+    int n_features;
+    int max_bins;
+} BinMapper;
+
+// Counter-based random number stream (random.c). Draws are a pure function
+// of (seed, stream id, draw counter), so streams need no locking and give
+// the same numbers on any thread.
 typedef struct {
-    double **features;
+    uint64_t key;
+    uint64_t counter;
+} RandomStream;
+
+// Features are stored column-major in one buffer: feature f of sample i is
+// features[f * stride + i]. Columns of an owned dataset start on a cache
+// line; views into a dataset (e.g. the test split) share its stride.
+// A reduced storage precision replaces features with features32 or with
+// 16-bit fixed-point codes; gather_feature reads any of them as double.
+typedef struct {
+    double *features;   // NULL once the storage precision was reduced
+    float *features32;  // PRECISION_FLOAT columns
+    uint16_t *features16; // PRECISION_FIXED16 codes: fixed_base + code * fixed_step
+    double *fixed_base; // Per feature
+    double *fixed_step;
+    int precision;
     int *labels;
     int n_samples;
     int n_features;
+    int stride;         // Distance between consecutive columns
+    uint8_t *binned;    // Bin codes, same layout as features; NULL unless binned
+    BinMapper *bins;    // Shared mapper, not owned by the dataset
+    size_t file_bytes;  // Size of the file it was loaded from, 0 otherwise
+    void *mapping;      // Cache file mapping holding features and labels, or NULL
+    size_t mapping_bytes;
 } Dataset;
 
+// Header of a binary dataset cache (see dataset_cache.c for the layout)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_features;
+    uint64_t n_samples;
+    uint64_t stride;
+    uint32_t max_bins;        // 0 if the file holds no bin edges
+    uint32_t reserved;
+    uint64_t features_offset;
+    uint64_t labels_offset;
+    uint64_t bins_offset;
+    uint64_t file_bytes;
+} DatasetCacheHeader;
+
 typedef struct {
     int feature_index;
     double threshold;
@@ -25,44 +76,280 @@ typedef struct {
     int is_leaf;
 } TreeNode;
 
+// Node of a frozen tree. Sixteen bytes, so a cache line holds four nodes.
+// Frozen trees are stored breadth-first, where siblings are adjacent: the
+// left child sits skip nodes after its parent and the right child right
+// after it. Leaves have skip == 0.
+typedef struct {
+    double threshold;
+    int32_t skip;
+    int32_t value;      // Split feature, or the class of a leaf
+} FlatNode;
+
 typedef struct {
     TreeNode *nodes;
     int n_nodes;
     int capacity;
+    FlatNode *flat;     // Inference layout, NULL until the tree is frozen
+    int n_flat;
 } DecisionTree;
 
+// Bump allocator for training temporaries. Each training thread owns one;
+// it is reserved once per tree and then handed out with stack discipline
+// (arena_mark / arena_release), so the hot path never touches the heap.
+typedef struct {
+    char *base;
+    size_t capacity;
+    size_t used;
+    size_t peak;
+    long heap_allocations;  // Times the arena had to (re)allocate its block
+} ScratchArena;
+
+// Split-evaluation kernels. get_split_kernels() picks the widest SIMD
+// implementation the CPU supports at runtime; every implementation returns
+// bit-identical results to the scalar one.
+typedef struct {
+    const char *name;
+    // Sets goes_left[i] = values[i] <= threshold and returns the left count
+    int (*partition)(const double *values, int n, double threshold, uint8_t *goes_left);
+    // Adds the occurrences of each class in labels to counts
+    void (*count_classes)(const int *labels, int n, int n_classes, int *counts);
+    // Scores the split between i and i + 1 for every i where the sorted values
+    // differ and both sides keep at least min_leaf samples; returns the best i
+    // (first on ties) or -1. left_counts needs n_classes entries and sq 2 * n
+    // entries of scratch.
+    int (*best_split)(const double *values, const int *labels, int n, const int *node_counts,
+                      int n_classes, int min_leaf, int *left_counts, double *sq,
+                      double *best_score);
+} SplitKernels;
+
+// Per-tree sample ordering used by the exact split search. Features are
+// sorted once per tree; afterwards each node's samples occupy the same
+// [begin, end) range in every order array, and splitting a node stably
+// partitions that range so every order stays sorted. Nodes read their
+// labels through the same range, so no node copies its samples.
+// The orders hold row ids of the shared training set. A bootstrap repeats a
+// row once per draw, so every count and score weighs rows by multiplicity.
+typedef struct {
+    int **order;      // One ascending order per selected feature
+    int *labels;      // Label of order[0][i] at position i
+    int *goes_left;   // Side of each training row for the split being applied
+    int *buffer;      // Scratch for the stable partition
+    double *values;   // Scratch for the node's values of the split feature
+    uint8_t *flags;   // Scratch for the partition kernel
+    const SplitKernels *kernels;
+    int n_orders;
+    int n_samples;
+    int n_classes;
+} SampleIndex;
+
+// Bounded per-tree pool of node histograms for the binned split search.
+// A histogram holds hist[f * stride + bin * n_classes + class] for every
+// selected feature f. Depth-first growth keeps at most one pending sibling
+// per level alive, so max_depth + 2 slots cover a whole tree.
+typedef struct {
+    int *data;
+    int *free_slots;  // Stack of free slot ids
+    int n_free;
+    int n_slots;
+    int stride;       // Ints per feature: max_bins * n_classes
+    int size;         // Ints per histogram: n_features * stride
+} HistogramPool;
+
+// Training knobs shared by every tree of a forest
+typedef struct {
+    int max_depth;
+    int min_samples_split;
+    int min_samples_leaf;         // Smallest child a split may create
+    int max_leaf_nodes;           // 0 = unlimited; otherwise grows best-first
+    double min_impurity_decrease; // Smallest weighted Gini decrease of a split,
+                                  // relative to the tree's sample count
+    int task_cutoff;  // Nodes with at least this many samples grow their
+                      // subtrees as OpenMP tasks (0 disables tasking)
+    int growth;       // GROWTH_DEPTH_FIRST, GROWTH_LEVEL_WISE or GROWTH_BEST_FIRST
+    int inner_threads; // Team that searches one node's splits (1 = the tree's thread);
+                       // 0 lets train_random_forest choose
+    int inner_cutoff;  // Smallest node, in samples, that gets the inner team
+    int data_parallel; // Inner teams split a level's rows instead of its features
+                       // (binned level-wise growth only)
+} TreeParams;
+
+// Node of the level being grown by the level-wise builder
+typedef struct {
+    int begin;        // Sample range in the SampleIndex
+    int end;
+    int node;         // Index in the tree
+} FrontierNode;
+
+// Leaf waiting in the best-first builder's queue, with the split it takes
+// when it is expanded
+typedef struct {
+    int begin;
+    int end;
+    int node;
+    int depth;
+    int feature;
+    double threshold;
+    double gain;      // Score increase of the split, n_node * Gini decrease
+} SplitCandidate;
+
+// Per-tree state shared by the node builders. Arenas are indexed by the
+// thread executing a node, since subtree tasks may run on any thread of the
+// training team.
+typedef struct {
+    Dataset *data;
+    SampleIndex *index;
+    HistogramPool *pool;
+    int *feature_indices;
+    int n_features;
+    int max_depth;
+    int min_samples_split;
+    int min_samples_leaf;
+    int max_leaf_nodes;
+    double min_gain;       // min_impurity_decrease in score units
+    int task_cutoff;
+    int inner_threads;
+    int inner_cutoff;
+    int data_parallel;
+    ScratchArena **arenas;
+    size_t scratch_bytes;  // Arena reservation that covers one tree
+} TreeBuilder;
+
+// Internal node of a QuickScorer forest. When a sample goes right at the
+// node, the leaves of its left subtree become unreachable; they are a
+// contiguous run of the tree's leaf bitvector, cleared word by word.
+typedef struct {
+    int first_word;       // Global words spanned by the left subtree's leaves
+    int last_word;
+    uint64_t first_keep;  // Bits of first_word and last_word that survive
+    uint64_t last_keep;
+} QuickScorerNode;
+
+// Forest compiled for QuickScorer inference (quickscorer.c). The internal
+// nodes of all trees are grouped by feature and sorted by threshold; leaves
+// are numbered left to right within each tree.
+typedef struct {
+    int n_features;
+    int *offsets;          // Nodes of feature f: [offsets[f], offsets[f + 1])
+    double *thresholds;    // Ascending within each feature
+    QuickScorerNode *nodes;
+    int n_nodes;
+    int n_trees;
+    int n_words;           // Bitvector words of all trees
+    int *tree_words;       // Tree t spans words [tree_words[t], tree_words[t + 1])
+    int *tree_leaves;      // First leaf of tree t in leaf_class
+    int *leaf_class;
+} QuickScorer;
+
+// Walks samples down one padded tree: leaf[i] = exit leaf of row i of X
+// (row-major, stride columns) after exactly depth steps
+typedef void (*PerfectWalk)(const double *thresholds, const int32_t *features, int depth,
+                            const double *X, int n, int stride, int32_t *leaf);
+
+// Forest padded to complete binary trees (perfect_tree.c). A tree of depth
+// d keeps its 2^d - 1 internal nodes in heap order, the children of node i
+// at 2i + 1 and 2i + 2, and its 2^d leaf classes; a leaf above depth d is
+// repeated into every leaf of the subtree it would have had. Trees deeper
+// than PERFECT_MAX_DEPTH are left to predict_tree.
+typedef struct {
+    int n_trees;
+    int *depth;            // Steps of tree t, or -1 if it is not padded
+    size_t *node_offset;   // First internal node of tree t
+    size_t *leaf_offset;   // First leaf of tree t in leaf_class
+    double *thresholds;
+    int32_t *features;
+    int32_t *leaf_class;
+    DecisionTree *trees;   // Of the forest, for the trees that are not padded
+    const char *kernel;    // Name of walk
+    PerfectWalk walk;
+} PerfectForest;
+
 typedef struct {
     DecisionTree *trees;
     int n_trees;
     int max_depth;
     int min_samples_split;
     int n_features_per_tree;
+    TreeParams params;
+    uint64_t seed;    // Tree t draws its features and bootstrap from stream t
+    int schedule;     // SCHEDULE_* order in which threads take trees
+    int n_features;   // Columns of the samples the trees were trained on
+    int n_classes;    // Vote slots: largest leaf class + 1 (finalize_forest)
+    int engine;       // ENGINE_* that predict_forest_block scores with
+    QuickScorer *quickscorer;  // Compiled by set_inference_engine, else NULL
+    PerfectForest *perfect;    // Likewise
 } RandomForest;
 
+// Settings and results of out-of-core training (streaming.c)
 typedef struct {
+    size_t memory_limit;  // Bytes for chunks, trees and node histograms
+    int max_bins;
+    double train_ratio;
+    uint64_t seed;        // Fixes the train/test split and the bootstrap weights
+    BinMapper *bins;      // Set by train_streaming_forest, owned by the caller
+    int n_passes;         // Passes over the data, the initial scan included
+} StreamParams;
+
+typedef struct {
+    double load_time;
+    double load_mb_per_s;
     double execution_time;
     double accuracy;
     int n_trees_used;
     int n_threads_used;
+    double peak_rss_mb;
 } PerformanceMetrics;
 
 // Function declarations
 
 // Dataset operations
+Dataset* create_dataset(int n_samples, int n_features);
 Dataset* load_dataset(const char* filename);
+int is_dataset_cache(const void* data, size_t size);
+int save_dataset_cache(Dataset* dataset, BinMapper* bins, const char* filename);
+Dataset* open_dataset_cache(void* mapping, size_t size, const char* filename);
+int check_cache_header(const DatasetCacheHeader* header, size_t size);
+int parse_csv_row(const char* p, const char* end, Dataset* dataset, int row);
+int count_csv_columns(const char* p, const char* end);
 void free_dataset(Dataset* dataset);
-void shuffle_dataset(Dataset* dataset);
-Dataset* bootstrap_sample(Dataset* original, int sample_size);
+void shuffle_dataset(Dataset* dataset, RandomStream* rng);
+int* bootstrap_sample(Dataset* original, int sample_size, RandomStream* rng);
+Dataset* create_dataset_view(Dataset* dataset, int first, int n_samples);
+void gather_feature(Dataset* dataset, int feature, const int* rows, int n, double* values);
+void get_sample(Dataset* dataset, int i, double* sample);
+int parse_precision(const char* name);
+const char* precision_name(int precision);
+void set_dataset_precision(Dataset* dataset, int precision);
 void print_dataset_info(Dataset* dataset);
+BinMapper* create_bin_mapper(Dataset* dataset, int max_bins);
+void free_bin_mapper(BinMapper* bins);
+void bin_dataset(Dataset* dataset, BinMapper* bins);
+int find_bin(BinMapper* bins, int feature, double value);
 
 // Decision Tree operations
 DecisionTree* create_decision_tree(int max_depth, int min_samples_split);
 void free_decision_tree(DecisionTree* tree);
-void train_decision_tree(DecisionTree* tree, Dataset* data, int* feature_indices, int n_features);
+void train_decision_tree(DecisionTree* tree, Dataset* data, int* rows, int n_rows,
+                         int* feature_indices, int n_features, TreeParams* params,
+                         ScratchArena** arenas);
+int freeze_tree(DecisionTree* tree);
 int predict_tree(DecisionTree* tree, double* sample);
 double calculate_gini_impurity(int* labels, int n_samples);
-int find_best_split(Dataset* data, int* indices, int n_samples, int* feature_indices, 
-                   int n_features, int* best_feature, double* best_threshold);
+SampleIndex* create_sample_index(Dataset* data, int* rows, int n_rows, int* feature_indices,
+                                 int n_features, int n_classes, ScratchArena* arena);
+int partition_sample_index(SampleIndex* index, Dataset* data, int begin, int end,
+                           int feature, double threshold);
+HistogramPool* create_histogram_pool(int n_features, int max_bins, int n_classes, int n_slots,
+                                     ScratchArena* arena);
+int* acquire_histogram(HistogramPool* pool);
+void release_histogram(HistogramPool* pool, int* hist);
+void build_node_histogram(Dataset* data, SampleIndex* index, int begin, int end,
+                          int* feature_indices, int n_features, HistogramPool* pool, int* hist,
+                          int n_threads);
+int find_best_split(Dataset* data, SampleIndex* index, int begin, int end, int* feature_indices,
+                   int n_features, HistogramPool* pool, int* node_hist, ScratchArena* arena,
+                   int n_threads, int min_samples_leaf, double min_gain, int* best_feature,
+                   double* best_threshold, double* best_gain);
 
 // Random Forest operations
 RandomForest* create_random_forest(int n_trees, int max_depth, int min_samples_split, int n_features_per_tree);
@@ -71,17 +358,104 @@ void train_random_forest(RandomForest* rf, Dataset* training_data);
 int predict_random_forest(RandomForest* rf, double* sample);
 double evaluate_accuracy(RandomForest* rf, Dataset* test_data);
 
+// Batched inference (inference.c)
+void finalize_forest(RandomForest* rf, int n_features);
+void predict_forest_block(RandomForest* rf, double* X, int n, int* votes, int* out);
+void predict_random_forest_batch(RandomForest* rf, double* X, int n, int* out);
+void set_inference_engine(RandomForest* rf, int engine);
+int parse_engine(const char* name);
+const char* engine_name(int engine);
+void print_engine_report(RandomForest* rf, Dataset* test_data);
+int predict_early_exit(RandomForest* rf, double* sample, double confidence, int* votes,
+                       double* fractions, int* n_evaluated);
+void print_early_exit_report(RandomForest* rf, Dataset* test_data, double confidence);
+
+// Model files
+int save_random_forest(RandomForest* rf, const char* filename);
+RandomForest* load_random_forest(const char* filename);
+
+// QuickScorer
+QuickScorer* compile_quickscorer(RandomForest* rf);
+void free_quickscorer(QuickScorer* qs);
+void quickscorer_votes(QuickScorer* qs, double* X, int n, int stride, int* votes, int n_classes);
+
+// Padded perfect trees
+PerfectForest* compile_perfect_forest(RandomForest* rf);
+void free_perfect_forest(PerfectForest* pf);
+void perfect_forest_votes(PerfectForest* pf, double* X, int n, int stride, int* votes, int n_classes);
+
+// Out-of-core training
+int train_streaming_forest(RandomForest* rf, const char* filename, StreamParams* params);
+double evaluate_streaming_accuracy(RandomForest* rf, const char* filename, StreamParams* params);
+
 // Utility functions
 double get_time_diff(struct timeval start, struct timeval end);
 void print_performance_metrics(PerformanceMetrics* metrics, const char* dataset_name);
-int* generate_random_features(int n_total_features, int n_selected_features);
+int* predict_reference(RandomForest* reference, Dataset* test_data);
+void print_precision_report(RandomForest* reference, int* reference_predictions, RandomForest* rf,
+                            Dataset* test_data);
+int* generate_random_features(int n_total_features, int n_selected_features, RandomStream* rng);
 int get_majority_class(int* predictions, int n_predictions);
 void merge_sort(double* arr, int n);
+void merge_sort_by_key(double* keys, int* values, int n, ScratchArena* arena);
+void* malloc_aligned(size_t bytes);
+double get_peak_rss_mb(void);
+
+// Random numbers
+RandomStream random_stream(uint64_t seed, uint64_t stream_id);
+uint64_t random_at(const RandomStream* rng, uint64_t counter);
+uint64_t random_next(RandomStream* rng);
+uint32_t random_below(RandomStream* rng, uint32_t n);
+double random_unit(uint64_t bits);
+
+// Scratch arenas
+ScratchArena* create_scratch_arena(void);
+void free_scratch_arena(ScratchArena* arena);
+void arena_reserve(ScratchArena* arena, size_t bytes);
+void* arena_alloc(ScratchArena* arena, size_t bytes);
+void* arena_calloc(ScratchArena* arena, size_t bytes);
+size_t arena_mark(ScratchArena* arena);
+void arena_release(ScratchArena* arena, size_t mark);
+size_t arena_size(size_t bytes);
+void print_arena_stats(ScratchArena** arenas, int n_arenas);
+
+// Split kernels
+int get_available_split_kernels(const SplitKernels** kernels);
+const SplitKernels* get_split_kernels(void);
 
 // Constants
 #define MAX_TREE_DEPTH 10
 #define MIN_SAMPLES_SPLIT 2
 #define DEFAULT_N_TREES 100
 #define DEFAULT_N_FEATURES_RATIO 0.33  // sqrt(n_features) / n_features approximation
+#define MAX_BINS 256                   // Bin codes are stored as uint8_t
+#define MAX_SPLIT_KERNELS 3            // scalar, avx2, avx512
+#define DEFAULT_TASK_CUTOFF 2048       // Node size above which subtrees become tasks
+#define DEFAULT_INNER_CUTOFF 4096      // Node size above which a split search gets
+                                       // its own team, when threads outnumber trees
+
+// Tree growth strategies
+#define GROWTH_DEPTH_FIRST 0           // Recursive, one node at a time
+#define GROWTH_LEVEL_WISE 1            // Breadth-first, one depth level at a time
+#define GROWTH_BEST_FIRST 2            // Largest impurity decrease first
+// Tree schedules of the parallel forest
+#define SCHEDULE_STATIC 0              // Fixed blocks of trees per thread
+#define SCHEDULE_DYNAMIC 1             // Next tree to the first free thread
+#define SCHEDULE_COST 2                // Dynamic, largest estimated cost first
+#define MAX_HISTOGRAM_SLOTS 64         // Cap of the per-tree histogram pool
+#define CACHE_LINE 64
+#define PREDICT_BLOCK_SAMPLES 64       // Samples that walk each tree back to back
+#define ENGINE_TREE 0                  // Inference engines: walk the frozen trees
+#define ENGINE_QUICKSCORER 1           // Bitvectors over threshold-sorted nodes
+#define QUICKSCORER_LANES 8            // Samples scored together by QuickScorer
+#define ENGINE_PERFECT 2               // Branchless walk of padded complete trees
+#define PERFECT_MAX_DEPTH 12           // Deepest tree that is padded (64 KB of nodes)
+#define DATASET_CACHE_MAGIC "ARFDSET"  // First 8 bytes of a binary dataset cache
+#define PRECISION_DOUBLE 0             // Feature storage precisions
+#define PRECISION_FLOAT 1
+#define PRECISION_FIXED16 2            // Per-feature 16-bit fixed point
+#define DEFAULT_STREAM_BINS 64         // Bins of streaming training without -b
+#define RANDOM_STREAM_SHUFFLE UINT64_MAX // Stream of the train/test shuffle; trees
+                                         // use the ids below the tree count
 
 #endif // RANDOM_FOREST_H
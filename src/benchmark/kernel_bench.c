@@ -0,0 +1,171 @@
+#include "random_forest.h"
+
+// Checks every SIMD split kernel the CPU supports against the scalar one and
+// times them. The split choice (position and score bits), the partition
+// flags and the class counts must all match exactly.
+
+#define BENCH_REPEATS 200
+
+static int failures = 0;
+
+static void fill_sorted_values(double* values, int n, int n_distinct) {
+    for (int i = 0; i < n; i++) {
+        values[i] = (double)(rand() % n_distinct) * 0.37 - 5.0;
+    }
+    merge_sort(values, n);
+}
+
+static void fill_labels(int* labels, int n, int n_classes) {
+    for (int i = 0; i < n; i++) {
+        labels[i] = rand() % n_classes;
+    }
+}
+
+static void check(int ok, const char* kernel, const char* what, int n, int n_classes) {
+    if (!ok) {
+        printf("  MISMATCH %-8s %-14s n=%d classes=%d\n", kernel, what, n, n_classes);
+        failures++;
+    }
+}
+
+static void verify_kernels(const SplitKernels** kernels, int n_kernels, int n, int n_classes,
+                           int n_distinct, int min_leaf) {
+    double* values = malloc(n * sizeof(double));
+    int* labels = malloc(n * sizeof(int));
+    int* node_counts = calloc(n_classes, sizeof(int));
+    int* left_counts = malloc(n_classes * sizeof(int));
+    double* sq = malloc(2 * n * sizeof(double));
+    uint8_t* ref_flags = malloc(n);
+    uint8_t* flags = malloc(n);
+    int* ref_counts = malloc(n_classes * sizeof(int));
+    int* counts = malloc(n_classes * sizeof(int));
+
+    fill_sorted_values(values, n, n_distinct);
+    fill_labels(labels, n, n_classes);
+    for (int i = 0; i < n; i++) node_counts[labels[i]]++;
+    double threshold = values[n / 2];
+
+    const SplitKernels* ref = kernels[0];
+    double ref_score;
+    int ref_best = ref->best_split(values, labels, n, node_counts, n_classes, min_leaf,
+                                   left_counts, sq, &ref_score);
+    int ref_left = ref->partition(values, n, threshold, ref_flags);
+    memset(ref_counts, 0, n_classes * sizeof(int));
+    ref->count_classes(labels, n, n_classes, ref_counts);
+
+    for (int k = 1; k < n_kernels; k++) {
+        double score;
+        int best = kernels[k]->best_split(values, labels, n, node_counts, n_classes, min_leaf,
+                                          left_counts, sq, &score);
+        check(best == ref_best && memcmp(&score, &ref_score, sizeof(double)) == 0,
+              kernels[k]->name, "best_split", n, n_classes);
+
+        int left = kernels[k]->partition(values, n, threshold, flags);
+        check(left == ref_left && memcmp(flags, ref_flags, n) == 0,
+              kernels[k]->name, "partition", n, n_classes);
+
+        memset(counts, 0, n_classes * sizeof(int));
+        kernels[k]->count_classes(labels, n, n_classes, counts);
+        check(memcmp(counts, ref_counts, n_classes * sizeof(int)) == 0,
+              kernels[k]->name, "count_classes", n, n_classes);
+    }
+
+    free(values);
+    free(labels);
+    free(node_counts);
+    free(left_counts);
+    free(sq);
+    free(ref_flags);
+    free(flags);
+    free(ref_counts);
+    free(counts);
+}
+
+static void time_kernels(const SplitKernels** kernels, int n_kernels, int n, int n_classes) {
+    double* values = malloc(n * sizeof(double));
+    int* labels = malloc(n * sizeof(int));
+    int* node_counts = calloc(n_classes, sizeof(int));
+    int* left_counts = malloc(n_classes * sizeof(int));
+    double* sq = malloc(2 * n * sizeof(double));
+    uint8_t* flags = malloc(n);
+    int* counts = calloc(n_classes, sizeof(int));
+
+    fill_sorted_values(values, n, n);
+    fill_labels(labels, n, n_classes);
+    for (int i = 0; i < n; i++) node_counts[labels[i]]++;
+
+    printf("n=%d classes=%d (ns per sample)\n", n, n_classes);
+    printf("  %-8s %12s %12s %12s\n", "kernel", "best_split", "partition", "count");
+
+    for (int k = 0; k < n_kernels; k++) {
+        struct timeval start, end;
+        double score;
+        volatile int sink = 0;
+
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            sink += kernels[k]->best_split(values, labels, n, node_counts, n_classes, 1,
+                                           left_counts, sq, &score);
+        }
+        gettimeofday(&end, NULL);
+        double split_ns = get_time_diff(start, end) * 1e9 / ((double)BENCH_REPEATS * n);
+
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            sink += kernels[k]->partition(values, n, values[r % n], flags);
+        }
+        gettimeofday(&end, NULL);
+        double partition_ns = get_time_diff(start, end) * 1e9 / ((double)BENCH_REPEATS * n);
+
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            kernels[k]->count_classes(labels, n, n_classes, counts);
+        }
+        gettimeofday(&end, NULL);
+        double count_ns = get_time_diff(start, end) * 1e9 / ((double)BENCH_REPEATS * n);
+
+        printf("  %-8s %12.3f %12.3f %12.3f\n", kernels[k]->name, split_ns, partition_ns, count_ns);
+        (void)sink;
+    }
+
+    free(values);
+    free(labels);
+    free(node_counts);
+    free(left_counts);
+    free(sq);
+    free(flags);
+    free(counts);
+}
+
+int main(void) {
+    const SplitKernels* kernels[MAX_SPLIT_KERNELS];
+    int n_kernels = get_available_split_kernels(kernels);
+
+    printf("=== Split Kernel Benchmark ===\n");
+    printf("Available kernels:");
+    for (int k = 0; k < n_kernels; k++) printf(" %s", kernels[k]->name);
+    printf(" (selected: %s)\n", get_split_kernels()->name);
+    printf("---\n");
+
+    srand(42);
+    int sizes[] = {2, 3, 7, 8, 9, 17, 100, 1000, 30000};
+    int classes[] = {2, 3, 5, 16, 40};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+            for (int trial = 0; trial < 20; trial++) {
+                // From all-equal values to all-distinct ones, and from no
+                // leaf size limit to one that rules out every split
+                int n_distinct = 1 + rand() % sizes[s];
+                int min_leaf = trial < 10 ? 1 : 1 + rand() % (sizes[s] / 2 + 1);
+                verify_kernels(kernels, n_kernels, sizes[s], classes[c], n_distinct, min_leaf);
+            }
+        }
+    }
+    printf("Verification: %s\n", failures == 0 ? "all kernels match scalar" : "MISMATCHES FOUND");
+    printf("---\n");
+
+    time_kernels(kernels, n_kernels, 1000, 3);
+    time_kernels(kernels, n_kernels, 100000, 5);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include "random_forest.h"
+
+// Turns a saved forest into a standalone C file. Every tree becomes a
+// function of nested if/else on constant thresholds, so a compiled model
+// has no node arrays to load; the entry point votes like
+// predict_random_forest.
+
+static void print_usage(const char* program) {
+    printf("Usage: %s <model_file> [options]\n", program);
+    printf("Options:\n");
+    printf("  -o <source_file>   Write the C source here (default: standard output)\n");
+    printf("  -f <function>      Name of the entry point (default: predict)\n");
+    printf("  -h                 Show this help\n");
+    printf("Models are written by rf_sequential or rf_parallel with --save-model.\n");
+    printf("Build the output with e.g. cc -O3 -c forest.c, or cc -O3 -shared -fPIC.\n");
+}
+
+// Shortest decimal that reads back as the same double, always a double
+// literal (an integral value gets ".0", so x is never compared as an int)
+static void format_threshold(double value, char* buffer, size_t size) {
+    snprintf(buffer, size, "%.17g", value);
+    for (int precision = 1; precision < 17; precision++) {
+        char shorter[64];
+        snprintf(shorter, sizeof(shorter), "%.*g", precision, value);
+        if (strtod(shorter, NULL) == value) {
+            snprintf(buffer, size, "%s", shorter);
+            break;
+        }
+    }
+    if (!strpbrk(buffer, ".eEn")) {
+        strncat(buffer, ".0", size - strlen(buffer) - 1);
+    }
+}
+
+static void emit_node(FILE* out, DecisionTree* tree, int node_idx, int depth) {
+    TreeNode* node = &tree->nodes[node_idx];
+    int indent = 4 * (depth + 1);
+    if (node->is_leaf) {
+        fprintf(out, "%*sreturn %d;\n", indent, "", node->prediction);
+        return;
+    }
+
+    char threshold[64];
+    format_threshold(node->threshold, threshold, sizeof(threshold));
+    // A NaN fails the test and goes right, as in predict_tree
+    fprintf(out, "%*sif (x[%d] <= %s) {\n", indent, "", node->feature_index, threshold);
+    emit_node(out, tree, node->left_child, depth + 1);
+    fprintf(out, "%*s} else {\n", indent, "");
+    emit_node(out, tree, node->right_child, depth + 1);
+    fprintf(out, "%*s}\n", indent, "");
+}
+
+static void emit_forest(FILE* out, RandomForest* rf, const char* model_path, const char* function) {
+    fprintf(out, "// Generated by rf_codegen from %s: %d trees, %d features, %d classes.\n",
+            model_path, rf->n_trees, rf->n_features, rf->n_classes);
+    fprintf(out, "//\n");
+    fprintf(out, "// int %s(const RF_FEATURE* x) returns the majority vote of the trees for\n",
+            function);
+    fprintf(out, "// the %d values of x, ties to the lowest class. x is compared with the\n",
+            rf->n_features);
+    fprintf(out, "// double thresholds exactly; define RF_FEATURE as double to score the\n");
+    fprintf(out, "// values the forest was trained on without rounding them to float.\n\n");
+    fprintf(out, "#ifndef RF_FEATURE\n#define RF_FEATURE float\n#endif\n\n");
+
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        fprintf(out, "static int tree_%d(const RF_FEATURE* x) {\n", t);
+        if (tree->n_nodes == 0) {
+            fprintf(out, "    (void)x;\n    return 0;\n");
+        } else {
+            if (tree->nodes[0].is_leaf) fprintf(out, "    (void)x;\n");
+            emit_node(out, tree, 0, 0);
+        }
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "int %s(const RF_FEATURE* x) {\n", function);
+    fprintf(out, "    int votes[%d] = {0};\n", rf->n_classes);
+    for (int t = 0; t < rf->n_trees; t++) {
+        fprintf(out, "    votes[tree_%d(x)]++;\n", t);
+    }
+    fprintf(out, "    int best = 0;\n");
+    fprintf(out, "    for (int c = 1; c < %d; c++) {\n", rf->n_classes);
+    fprintf(out, "        if (votes[c] > votes[best]) best = c;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return best;\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+        print_usage(argv[0]);
+        return argc < 2;
+    }
+
+    const char* model_path = argv[1];
+    const char* source_path = NULL;
+    const char* function = "predict";
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            source_path = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            function = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+
+    RandomForest* rf = load_random_forest(model_path);
+    if (!rf) return 1;
+
+    FILE* out = source_path ? fopen(source_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create %s\n", source_path);
+        free_random_forest(rf);
+        return 1;
+    }
+    emit_forest(out, rf, model_path, function);
+
+    int status = 0;
+    if (source_path) {
+        if (fclose(out) != 0) {
+            fprintf(stderr, "Error: Failed to write %s\n", source_path);
+            status = 1;
+        } else {
+            fprintf(stderr, "Wrote %s: %d trees as C functions, entry point %s\n", source_path,
+                    rf->n_trees, function);
+        }
+    }
+    free_random_forest(rf);
+    return status;
+}
@@ -1,6 +1,7 @@
 #include "random_forest.h"
 #include <stdlib.h>
 #include <string.h>
+#include <omp.h>
 
 void print_usage(const char* program_name) {
     printf("Usage: %s <dataset_path> [options]\n", program_name);
@@ -8,11 +9,115 @@ void print_usage(const char* program_name) {
     printf("  -t <num_trees>     Number of trees (default: 100)\n");
     printf("  -d <max_depth>     Maximum tree depth (default: 10)\n");
     printf("  -s <min_samples>   Minimum samples to split (default: 2)\n");
+    printf("  -m <min_leaf>      Minimum samples in each child of a split (default: 1)\n");
+    printf("  -l <max_leaves>    Maximum leaves per tree, grown best-first (default: 0, unlimited)\n");
+    printf("  -i <min_decrease>  Minimum weighted Gini decrease of a split (default: 0.0)\n");
     printf("  -f <num_features>  Features per tree (default: sqrt(total_features))\n");
     printf("  -r <train_ratio>   Training set ratio (default: 0.8)\n");
+    printf("  -b <max_bins>      Histogram split search with at most max_bins (2-256) bins\n");
+    printf("                     per feature (default: 0, exact split search)\n");
+    printf("  -g <growth>        Tree growth: depth (recursive), level (one depth level at\n");
+    printf("                     a time) or best (largest Gini decrease first); all grow the\n");
+    printf("                     same trees unless -l is set (default: depth)\n");
+    printf("  --schedule <order> Order in which threads take trees: static (fixed blocks),\n");
+    printf("                     dynamic (next tree to the first free thread) or cost\n");
+    printf("                     (dynamic, largest estimated cost first) (default: cost)\n");
+    printf("  --inner-threads <n> Threads searching the splits of one node (default: 0, the\n");
+    printf("                     threads left over after one per tree; 1 disables)\n");
+    printf("  --inner-cutoff <n> Smallest node, in samples, searched by more than one thread\n");
+    printf("                     (default: %d)\n", DEFAULT_INNER_CUTOFF);
+    printf("  --data-parallel    Inner teams split each level's rows and merge per-thread\n");
+    printf("                     histograms, for a few trees on many rows (needs -b; grows\n");
+    printf("                     level-wise)\n");
+    printf("  -c <task_cutoff>   Grow subtrees of nodes with at least this many samples\n");
+    printf("                     as OpenMP tasks (default: %d, 0 disables tasks)\n", DEFAULT_TASK_CUTOFF);
+    printf("  -e <engine>        Inference engine: tree (walk each tree), quickscorer\n");
+    printf("                     (bitvectors over threshold-sorted nodes; experimental,\n");
+    printf("                     slower than tree on deep trees over few features) or perfect\n");
+    printf("                     (branchless SIMD walk of trees padded to complete binary\n");
+    printf("                     trees), checked against tree after evaluation (default: tree)\n");
+    printf("  -p <precision>     Feature storage: double, float or fixed16 (16-bit fixed\n");
+    printf("                     point per feature) (default: double)\n");
+    printf("  -v                 With -p, also train a double-precision forest from the same\n");
+    printf("                     random state and report split and prediction differences\n");
+    printf("  -w <cache_file>    Write the dataset (and bin edges with -b) to a binary cache\n");
+    printf("                     that later runs load instead of the CSV file\n");
+    printf("  --memory-limit <MB> Train out of core: stream the data from disk in chunks and\n");
+    printf("                     grow all trees level by level within this memory budget\n");
+    printf("                     (histogram splits, -b bins or %d; -g, -l, -p, -v, -w and\n", DEFAULT_STREAM_BINS);
+    printf("                     --early-exit are ignored)\n");
+    printf("  --early-exit <confidence> After evaluation, also score the test samples one at a\n");
+    printf("                     time, stopping each vote once the leading class cannot be\n");
+    printf("                     overtaken (1) or is ahead with this confidence (< 1), and\n");
+    printf("                     report the trees evaluated and the latency saved\n");
+    printf("  --save-model <file> Save the trained forest; rf_codegen turns it into C\n");
+    printf("  --seed <seed>      Seed of the shuffle, bootstraps and feature subsets; a forest\n");
+    printf("                     is the same for any thread count (default: current time)\n");
     printf("  -h                 Show this help\n");
 }
 
+// Out-of-core mode: the data is read from disk once per pass and never
+// loaded, so memory stays within memory_limit_mb whatever the dataset size
+static int run_streaming(const char* dataset_path, RandomForest* rf, int max_bins,
+                         double train_ratio, double memory_limit_mb, uint64_t seed,
+                         int engine, const char* model_path, int n_threads) {
+    StreamParams stream;
+    stream.memory_limit = (size_t)(memory_limit_mb * 1024.0 * 1024.0);
+    stream.max_bins = max_bins > 0 ? max_bins : DEFAULT_STREAM_BINS;
+    stream.train_ratio = train_ratio;
+    stream.seed = seed;
+    stream.bins = NULL;
+    stream.n_passes = 0;
+    
+    struct timeval start_time, end_time;
+    gettimeofday(&start_time, NULL);
+    
+    int status = train_streaming_forest(rf, dataset_path, &stream);
+    
+    gettimeofday(&end_time, NULL);
+    double training_time = get_time_diff(start_time, end_time);
+    if (status != 0) {
+        fprintf(stderr, "Streaming training failed\n");
+        free_random_forest(rf);
+        free_bin_mapper(stream.bins);
+        return 1;
+    }
+    
+    printf("Training completed in %.4f seconds\n", training_time);
+    printf("---\n");
+    
+    if (model_path) save_random_forest(rf, model_path);
+    set_inference_engine(rf, engine);
+    gettimeofday(&start_time, NULL);
+    
+    double accuracy = evaluate_streaming_accuracy(rf, dataset_path, &stream);
+    
+    gettimeofday(&end_time, NULL);
+    double prediction_time = get_time_diff(start_time, end_time);
+    
+    printf("Prediction completed in %.4f seconds\n", prediction_time);
+    printf("---\n");
+    
+    printf("RESULT,%s,%d,1,%.4f,%.4f\n",
+           dataset_path, n_threads, training_time + prediction_time, accuracy);
+    
+    // Loading is part of every pass, so there is no separate load time
+    PerformanceMetrics metrics;
+    metrics.load_time = 0.0;
+    metrics.load_mb_per_s = 0.0;
+    metrics.execution_time = training_time + prediction_time;
+    metrics.accuracy = accuracy;
+    metrics.n_trees_used = rf->n_trees;
+    metrics.n_threads_used = n_threads;
+    metrics.peak_rss_mb = get_peak_rss_mb();
+    
+    print_performance_metrics(&metrics, dataset_path);
+    
+    free_random_forest(rf);
+    free_bin_mapper(stream.bins);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_usage(argv[0]);
@@ -24,8 +129,26 @@ int main(int argc, char* argv[]) {
     int n_trees = DEFAULT_N_TREES;
     int max_depth = MAX_TREE_DEPTH;
     int min_samples_split = MIN_SAMPLES_SPLIT;
+    int min_samples_leaf = 1;
+    int max_leaf_nodes = 0; // 0 = unlimited
+    double min_impurity_decrease = 0.0;
     int n_features_per_tree = -1; // Will be calculated as sqrt(total_features)
     double train_ratio = 0.8;
+    int max_bins = 0; // 0 = exact split search
+    int growth = GROWTH_DEPTH_FIRST;
+    char* cache_path = NULL;
+    char* model_path = NULL;
+    int precision = PRECISION_DOUBLE;
+    int engine = ENGINE_TREE;
+    double early_exit = 0.0;
+    int verify_precision = 0;
+    double memory_limit_mb = 0.0; // 0 = load the whole dataset
+    uint64_t seed = (uint64_t)time(NULL);
+    int task_cutoff = DEFAULT_TASK_CUTOFF;
+    int schedule = SCHEDULE_COST;
+    int inner_threads = 0; // 0 = chosen from the tree and thread counts
+    int inner_cutoff = DEFAULT_INNER_CUTOFF;
+    int data_parallel = 0;
     
     // Parse command line arguments
     for (int i = 2; i < argc; i++) {
@@ -35,18 +158,85 @@ int main(int argc, char* argv[]) {
             max_depth = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
             min_samples_split = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            min_samples_leaf = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            max_leaf_nodes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            min_impurity_decrease = atof(argv[++i]);
         } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
             n_features_per_tree = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
             train_ratio = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            max_bins = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "level") == 0) {
+                growth = GROWTH_LEVEL_WISE;
+            } else if (strcmp(argv[i], "best") == 0) {
+                growth = GROWTH_BEST_FIRST;
+            } else {
+                growth = GROWTH_DEPTH_FIRST;
+            }
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "static") == 0) {
+                schedule = SCHEDULE_STATIC;
+            } else if (strcmp(argv[i], "dynamic") == 0) {
+                schedule = SCHEDULE_DYNAMIC;
+            } else {
+                schedule = SCHEDULE_COST;
+            }
+        } else if (strcmp(argv[i], "--inner-threads") == 0 && i + 1 < argc) {
+            inner_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--inner-cutoff") == 0 && i + 1 < argc) {
+            inner_cutoff = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--data-parallel") == 0) {
+            data_parallel = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            task_cutoff = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            engine = parse_engine(argv[++i]);
+            if (engine < 0) {
+                fprintf(stderr, "Unknown inference engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            precision = parse_precision(argv[++i]);
+            if (precision < 0) {
+                fprintf(stderr, "Unknown precision %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verify_precision = 1;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc) {
+            memory_limit_mb = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--early-exit") == 0 && i + 1 < argc) {
+            early_exit = atof(argv[++i]);
+            if (early_exit <= 0.0 || early_exit > 1.0) {
+                fprintf(stderr, "Early-exit confidence must be in (0, 1]\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--save-model") == 0 && i + 1 < argc) {
+            model_path = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
         } else if (strcmp(argv[i], "-h") == 0) {
             print_usage(argv[0]);
             return 0;
         }
     }
     
-    // Initialize random seed
-    srand(time(NULL));
+    if (data_parallel && memory_limit_mb <= 0.0) {
+        if (max_bins <= 0 || max_leaf_nodes > 0) {
+            fprintf(stderr, "--data-parallel needs histogram splits (-b) and cannot be used with -l\n");
+            return 1;
+        }
+        growth = GROWTH_LEVEL_WISE;
+    }
     
     printf("=== Sequential Random Forest Implementation ===\n");
     printf("Dataset: %s\n", dataset_path);
@@ -54,9 +244,57 @@ int main(int argc, char* argv[]) {
     printf("  Trees: %d\n", n_trees);
     printf("  Max depth: %d\n", max_depth);
     printf("  Min samples split: %d\n", min_samples_split);
+    printf("  Min samples leaf: %d\n", min_samples_leaf);
+    if (max_leaf_nodes > 0) {
+        printf("  Max leaf nodes: %d\n", max_leaf_nodes);
+    }
+    if (min_impurity_decrease > 0.0) {
+        printf("  Min impurity decrease: %g\n", min_impurity_decrease);
+    }
     printf("  Train ratio: %.2f\n", train_ratio);
+    printf("  Seed: %llu\n", (unsigned long long)seed);
+    if (memory_limit_mb > 0.0) {
+        // Streaming always bins; run_streaming picks the same count
+        printf("  Split search: histogram (max %d bins)\n",
+               max_bins > 0 ? max_bins : DEFAULT_STREAM_BINS);
+    } else if (max_bins > 0) {
+        printf("  Split search: histogram (max %d bins)\n", max_bins);
+    } else {
+        printf("  Split search: exact\n");
+    }
+    if (max_leaf_nodes > 0 || growth == GROWTH_BEST_FIRST) {
+        printf("  Tree growth: best-first\n");
+    } else {
+        printf("  Tree growth: %s%s\n", growth == GROWTH_LEVEL_WISE ? "level-wise" : "depth-first",
+               data_parallel ? ", data-parallel histograms" : "");
+    }
+    printf("  Tree schedule: %s\n", schedule == SCHEDULE_STATIC ? "static" :
+           schedule == SCHEDULE_DYNAMIC ? "dynamic" : "dynamic, largest estimated cost first");
+    if (task_cutoff > 0) {
+        printf("  Subtree tasks: nodes with >= %d samples\n", task_cutoff);
+    } else {
+        printf("  Subtree tasks: disabled\n");
+    }
+    if (engine != ENGINE_TREE) {
+        printf("  Inference engine: %s\n", engine_name(engine));
+    }
+    if (precision != PRECISION_DOUBLE) {
+        printf("  Storage precision: %s%s\n", precision_name(precision),
+               verify_precision ? " (checked against double)" : "");
+    }
+    if (memory_limit_mb > 0.0) {
+        printf("  Memory limit: %.0f MB (streaming)\n", memory_limit_mb);
+    }
     printf("---\n");
     
+    if (memory_limit_mb > 0.0) {
+        RandomForest* rf = create_random_forest(n_trees, max_depth, min_samples_split, n_features_per_tree);
+        rf->params.min_samples_leaf = min_samples_leaf;
+        rf->params.min_impurity_decrease = min_impurity_decrease;
+        return run_streaming(dataset_path, rf, max_bins, train_ratio, memory_limit_mb, seed,
+                             engine, model_path, omp_get_max_threads());
+    }
+    
     // Load dataset
     struct timeval start_time, end_time;
     gettimeofday(&start_time, NULL);
@@ -67,10 +305,36 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    gettimeofday(&end_time, NULL);
+    double load_time = get_time_diff(start_time, end_time);
+    double load_mb = dataset->file_bytes / (1024.0 * 1024.0);
+    double load_mb_per_s = load_time > 0.0 ? load_mb / load_time : 0.0;
+    printf("Load completed in %.4f seconds (%.1f MB, %.1f MB/s)\n", load_time, load_mb,
+           load_mb_per_s);
+    
     print_dataset_info(dataset);
     
+    // Quantize features once, before the train/test split shares the columns
+    // A cache may carry bin edges; they are reused when the bin count matches
+    BinMapper* bins = dataset->bins;
+    if (bins && bins->max_bins != max_bins) {
+        free_bin_mapper(bins);
+        bins = NULL;
+    }
+    dataset->bins = NULL;
+    if (max_bins > 0) {
+        if (!bins) bins = create_bin_mapper(dataset, max_bins);
+        bin_dataset(dataset, bins);
+    }
+    
+    // Save the dataset before shuffling, so the cache matches the CSV file
+    if (cache_path && save_dataset_cache(dataset, bins, cache_path) != 0) {
+        fprintf(stderr, "Continuing without a cache\n");
+    }
+    
     // Shuffle dataset for random train/test split
-    shuffle_dataset(dataset);
+    RandomStream shuffle_rng = random_stream(seed, RANDOM_STREAM_SHUFFLE);
+    shuffle_dataset(dataset, &shuffle_rng);
     
     // Split into training and testing sets
     int train_size = (int)(dataset->n_samples * train_ratio);
@@ -78,20 +342,6 @@ int main(int argc, char* argv[]) {
     
     printf("Train/Test split: %d/%d samples\n", train_size, test_size);
     
-    // Create training dataset
-    Dataset* train_data = malloc(sizeof(Dataset));
-    train_data->n_samples = train_size;
-    train_data->n_features = dataset->n_features;
-    train_data->features = dataset->features; // Point to first part
-    train_data->labels = dataset->labels;
-    
-    // Create test dataset
-    Dataset* test_data = malloc(sizeof(Dataset));
-    test_data->n_samples = test_size;
-    test_data->n_features = dataset->n_features;
-    test_data->features = &dataset->features[train_size]; // Point to second part
-    test_data->labels = &dataset->labels[train_size];
-    
     // Calculate features per tree if not specified
     if (n_features_per_tree <= 0) {
         n_features_per_tree = (int)sqrt(dataset->n_features);
@@ -100,19 +350,59 @@ int main(int argc, char* argv[]) {
     printf("  Features per tree: %d\n", n_features_per_tree);
     printf("---\n");
     
-    // Create and train Random Forest
+    RandomForest* rf = create_random_forest(n_trees, max_depth, min_samples_split, n_features_per_tree);
+    rf->params.task_cutoff = task_cutoff;
+    rf->schedule = schedule;
+    rf->params.inner_threads = inner_threads;
+    rf->params.inner_cutoff = inner_cutoff;
+    rf->params.data_parallel = data_parallel;
+    rf->params.growth = growth;
+    rf->params.min_samples_leaf = min_samples_leaf;
+    rf->params.max_leaf_nodes = max_leaf_nodes;
+    rf->params.min_impurity_decrease = min_impurity_decrease;
+    rf->seed = seed;
+    
+    // To check a reduced precision, first train a forest on the double
+    // columns; with the same seed it draws the same bootstraps and features.
+    // Its test predictions are taken before the columns are rounded.
+    RandomForest* reference = NULL;
+    int* reference_predictions = NULL;
+    if (precision != PRECISION_DOUBLE) {
+        if (verify_precision) {
+            Dataset* reference_data = create_dataset_view(dataset, 0, train_size);
+            reference = create_random_forest(n_trees, max_depth, min_samples_split, n_features_per_tree);
+            reference->params = rf->params;
+            reference->seed = seed;
+            reference->schedule = rf->schedule;
+            printf("Training double-precision reference forest\n");
+            train_random_forest(reference, reference_data);
+            free(reference_data);
+            Dataset* reference_test = create_dataset_view(dataset, train_size, test_size);
+            reference_predictions = predict_reference(reference, reference_test);
+            free(reference_test);
+            printf("---\n");
+        }
+        set_dataset_precision(dataset, precision);
+    }
+    
+    // Split into training and testing views of the shuffled dataset
+    Dataset* train_data = create_dataset_view(dataset, 0, train_size);
+    Dataset* test_data = create_dataset_view(dataset, train_size, test_size);
+    
+    // Train Random Forest
     gettimeofday(&start_time, NULL);
     
-    RandomForest* rf = create_random_forest(n_trees, max_depth, min_samples_split, n_features_per_tree);
     train_random_forest(rf, train_data);
     
     gettimeofday(&end_time, NULL);
     double training_time = get_time_diff(start_time, end_time);
     
     printf("Training completed in %.4f seconds\n", training_time);
+    if (model_path) save_random_forest(rf, model_path);
     printf("---\n");
     
     // Evaluate model
+    set_inference_engine(rf, engine);
     gettimeofday(&start_time, NULL);
     
     double accuracy = evaluate_accuracy(rf, test_data);
@@ -134,13 +424,33 @@ int main(int argc, char* argv[]) {
     
     // Performance metrics
     PerformanceMetrics metrics;
+    metrics.load_time = load_time;
+    metrics.load_mb_per_s = load_mb_per_s;
     metrics.execution_time = training_time + prediction_time;
     metrics.accuracy = accuracy;
     metrics.n_trees_used = n_trees;
     metrics.n_threads_used = num_threads_used;
+    metrics.peak_rss_mb = get_peak_rss_mb();
     
     print_performance_metrics(&metrics, dataset_path);
     
+    if (engine != ENGINE_TREE) {
+        print_engine_report(rf, test_data);
+        printf("---\n");
+    }
+    
+    if (early_exit > 0.0) {
+        print_early_exit_report(rf, test_data, early_exit);
+        printf("---\n");
+    }
+    
+    if (reference) {
+        print_precision_report(reference, reference_predictions, rf, test_data);
+        printf("---\n");
+        free(reference_predictions);
+        free_random_forest(reference);
+    }
+    
     // Cleanup
     free_random_forest(rf);
     
@@ -150,6 +460,7 @@ int main(int argc, char* argv[]) {
     
     // Free the original dataset which owns all the memory
     free_dataset(dataset);
+    free_bin_mapper(bins);
     
     return 0;
 }
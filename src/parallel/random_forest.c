@@ -7,6 +7,23 @@ RandomForest* create_random_forest(int n_trees, int max_depth, int min_samples_s
     rf->max_depth = max_depth;
     rf->min_samples_split = min_samples_split;
     rf->n_features_per_tree = n_features_per_tree;
+    rf->params.max_depth = max_depth;
+    rf->params.min_samples_split = min_samples_split;
+    rf->params.min_samples_leaf = 1;
+    rf->params.max_leaf_nodes = 0;
+    rf->params.min_impurity_decrease = 0.0;
+    rf->params.task_cutoff = DEFAULT_TASK_CUTOFF;
+    rf->params.inner_threads = 0;
+    rf->params.inner_cutoff = DEFAULT_INNER_CUTOFF;
+    rf->params.data_parallel = 0;
+    rf->params.growth = GROWTH_DEPTH_FIRST;
+    rf->seed = 0;
+    rf->schedule = SCHEDULE_COST;
+    rf->n_features = 0;
+    rf->n_classes = 1;
+    rf->engine = ENGINE_TREE;
+    rf->quickscorer = NULL;
+    rf->perfect = NULL;
     
     rf->trees = malloc(n_trees * sizeof(DecisionTree));
     
@@ -14,6 +31,8 @@ RandomForest* create_random_forest(int n_trees, int max_depth, int min_samples_s
         rf->trees[i].nodes = NULL;
         rf->trees[i].n_nodes = 0;
         rf->trees[i].capacity = 0;
+        rf->trees[i].flat = NULL;
+        rf->trees[i].n_flat = 0;
     }
     
     return rf;
@@ -27,13 +46,101 @@ void free_random_forest(RandomForest* rf) {
             if (rf->trees[i].nodes) {
                 free(rf->trees[i].nodes);
             }
+            free(rf->trees[i].flat);
         }
         free(rf->trees);
     }
+    free_quickscorer(rf->quickscorer);
+    free_perfect_forest(rf->perfect);
     
     free(rf);
 }
 
+// Relative build cost of every tree. The split search scans each distinct
+// value (or bin) of every selected feature at every node, so a tree costs
+// roughly the sum of those counts over its features.
+static double* estimate_tree_costs(RandomForest* rf, Dataset* data) {
+    int n = data->n_samples;
+    double* feature_cost = malloc(data->n_features * sizeof(double));
+
+    #pragma omp parallel
+    {
+        double* values = data->bins ? NULL : malloc(n * sizeof(double));
+
+        #pragma omp for schedule(dynamic)
+        for (int f = 0; f < data->n_features; f++) {
+            if (data->bins) {
+                feature_cost[f] = data->bins->n_bins[f];
+                continue;
+            }
+            gather_feature(data, f, NULL, n, values);
+            merge_sort(values, n);
+            int n_distinct = n > 0 ? 1 : 0;
+            for (int i = 1; i < n; i++) {
+                if (values[i] != values[i - 1]) n_distinct++;
+            }
+            feature_cost[f] = n_distinct;
+        }
+
+        free(values);
+    }
+
+    // Features are the first draws of each tree's stream
+    double* costs = malloc(rf->n_trees * sizeof(double));
+    for (int t = 0; t < rf->n_trees; t++) {
+        RandomStream rng = random_stream(rf->seed, t);
+        int* features = generate_random_features(data->n_features, rf->n_features_per_tree, &rng);
+        costs[t] = 0.0;
+        for (int k = 0; k < rf->n_features_per_tree; k++) {
+            costs[t] += feature_cost[features[k]];
+        }
+        free(features);
+    }
+
+    free(feature_cost);
+    return costs;
+}
+
+// Build times of the trees and how long each thread waited for the others
+static void print_schedule_stats(RandomForest* rf, double* tree_times, double* busy,
+                                 int* trees_done, int n_threads, double wall_time) {
+    double total = 0.0, slowest = 0.0, fastest = tree_times[0];
+    int slowest_tree = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        total += tree_times[t];
+        if (tree_times[t] < fastest) fastest = tree_times[t];
+        if (tree_times[t] > slowest) {
+            slowest = tree_times[t];
+            slowest_tree = t;
+        }
+    }
+    printf("Tree build times: min %.4f s, mean %.4f s, max %.4f s (tree %d)\n", fastest,
+           total / rf->n_trees, slowest, slowest_tree);
+
+    double total_idle = 0.0;
+    for (int i = 0; i < n_threads; i++) {
+        double idle = wall_time - busy[i];
+        total_idle += idle;
+        printf("  Thread %2d: %3d trees, busy %.4f s, idle %.4f s\n", i, trees_done[i], busy[i],
+               idle);
+    }
+    printf("Thread idle time: %.4f s of %.4f s (%.1f%%)\n", total_idle, wall_time * n_threads,
+           wall_time > 0.0 ? 100.0 * total_idle / (wall_time * n_threads) : 0.0);
+}
+
+typedef struct {
+    double cost;
+    int tree;
+} TreeCost;
+
+// Decreasing cost, then increasing tree index
+static int compare_tree_costs(const void* a, const void* b) {
+    const TreeCost* x = a;
+    const TreeCost* y = b;
+    if (x->cost != y->cost) return x->cost < y->cost ? 1 : -1;
+    return x->tree - y->tree;
+}
+
 void train_random_forest(RandomForest* rf, Dataset* training_data) {
     printf("Training Random Forest with %d trees...\n", rf->n_trees);
 
@@ -48,14 +155,104 @@ void train_random_forest(RandomForest* rf, Dataset* training_data) {
     // Shared counter for progress tracking
     volatile int completed_trees = 0;
 
-    #pragma omp parallel for schedule(static)
-    for (int tree_idx = 0; tree_idx < rf->n_trees; tree_idx++) {
+    // One scratch arena per thread, reused by every tree the thread trains
+    int n_threads = omp_get_max_threads();
+    ScratchArena** arenas = malloc(n_threads * sizeof(ScratchArena*));
+    for (int i = 0; i < n_threads; i++) {
+        arenas[i] = create_scratch_arena();
+    }
+
+    // Queue of trees. Dynamic schedules hand them out one at a time, so a
+    // thread that finishes early takes the next tree instead of idling; the
+    // cost schedule also starts the most expensive trees first (longest
+    // processing time first), so none of them is left for the end.
+    int* order = malloc(rf->n_trees * sizeof(int));
+    for (int i = 0; i < rf->n_trees; i++) {
+        order[i] = i;
+    }
+    if (rf->schedule == SCHEDULE_COST) {
+        double* costs = estimate_tree_costs(rf, training_data);
+        TreeCost* queue = malloc(rf->n_trees * sizeof(TreeCost));
+        for (int i = 0; i < rf->n_trees; i++) {
+            queue[i].cost = costs[i];
+            queue[i].tree = i;
+        }
+        qsort(queue, rf->n_trees, sizeof(TreeCost), compare_tree_costs);
+        for (int i = 0; i < rf->n_trees; i++) {
+            order[i] = queue[i].tree;
+        }
+        free(queue);
+        free(costs);
+    }
+    omp_set_schedule(rf->schedule == SCHEDULE_STATIC ? omp_sched_static : omp_sched_dynamic,
+                     rf->schedule == SCHEDULE_STATIC ? 0 : 1);
+
+    // Thread budget: trees first, one per thread. Threads left over when
+    // there are fewer trees than threads form inner teams that search the
+    // splits of large nodes; an explicit inner team size shrinks the outer
+    // team instead, so the two levels never oversubscribe. Split search over
+    // features cannot use more threads than a tree has features; data-parallel
+    // teams split rows and take every leftover thread. Threads still left once
+    // every tree has a thread join the outer team without a tree of their own
+    // and run the subtree tasks of depth-first growth.
+    TreeParams params = rf->params;
+    int inner_threads = params.inner_threads;
+    if (inner_threads <= 0) {
+        int tree_threads = n_threads < rf->n_trees ? n_threads : rf->n_trees;
+        inner_threads = n_threads / (tree_threads > 0 ? tree_threads : 1);
+        if (!params.data_parallel && inner_threads > rf->n_features_per_tree) {
+            inner_threads = rf->n_features_per_tree;
+        }
+    }
+    if (inner_threads < 1) inner_threads = 1;
+    int tree_threads = n_threads / inner_threads;
+    if (tree_threads > rf->n_trees) tree_threads = rf->n_trees;
+    if (tree_threads < 1) tree_threads = 1;
+    params.inner_threads = inner_threads;
+    int spare_threads = n_threads - tree_threads * inner_threads;
+    int task_threads = 0;
+    if (spare_threads > 0 && tree_threads == rf->n_trees && params.task_cutoff > 0 &&
+        params.growth == GROWTH_DEPTH_FIRST) {
+        task_threads = spare_threads;
+    }
+    int outer_threads = tree_threads + task_threads;
+    int saved_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(inner_threads > 1 ? 2 : 1);
+    if (inner_threads > 1 && params.data_parallel) {
+        printf("Thread policy: %d tree threads x %d data-parallel threads for trees of %d+ samples",
+               tree_threads, inner_threads, params.inner_cutoff);
+    } else if (inner_threads > 1) {
+        printf("Thread policy: %d tree threads x %d split threads for nodes of %d+ samples",
+               tree_threads, inner_threads, params.inner_cutoff);
+    } else {
+        printf("Thread policy: %d tree threads, sequential split search", tree_threads);
+    }
+    if (task_threads > 0) {
+        printf(", + %d subtree task threads\n", task_threads);
+    } else if (spare_threads > 0) {
+        printf(", %d threads unused\n", spare_threads);
+    } else {
+        printf("\n");
+    }
+
+    double* tree_times = calloc(rf->n_trees, sizeof(double));
+    double* busy = calloc(n_threads, sizeof(double));
+    int* trees_done = calloc(n_threads, sizeof(int));
+    double start_time = omp_get_wtime();
 
-        // Create bootstrap sample
-        Dataset* bootstrap_data = bootstrap_sample(training_data, training_data->n_samples);
+    #pragma omp parallel for schedule(runtime) num_threads(outer_threads)
+    for (int k = 0; k < rf->n_trees; k++) {
+        int tree_idx = order[k];
+        double tree_start = omp_get_wtime();
+
+        // The tree's own random stream, independent of the thread training it
+        RandomStream rng = random_stream(rf->seed, tree_idx);
 
         // Select random features for this tree
-        int* feature_indices = generate_random_features(training_data->n_features, rf->n_features_per_tree);
+        int* feature_indices = generate_random_features(training_data->n_features, rf->n_features_per_tree, &rng);
+
+        // Bootstrap as row ids into the shared training set
+        int* rows = bootstrap_sample(training_data, training_data->n_samples, &rng);
 
         // Initialize decision tree
         DecisionTree* tree = &rf->trees[tree_idx];
@@ -64,12 +261,19 @@ void train_random_forest(RandomForest* rf, Dataset* training_data) {
         tree->n_nodes = 0;
 
         // Train the tree
-        train_decision_tree(tree, bootstrap_data, feature_indices, rf->n_features_per_tree);
+        train_decision_tree(tree, training_data, rows, training_data->n_samples, feature_indices,
+                            rf->n_features_per_tree, &params, arenas);
+        freeze_tree(tree);
 
         // Clean up
-        free_dataset(bootstrap_data);
+        free(rows);
         free(feature_indices);
 
+        int thread = omp_get_thread_num();
+        tree_times[tree_idx] = omp_get_wtime() - tree_start;
+        busy[thread] += tree_times[tree_idx];
+        trees_done[thread]++;
+
         // Update progress counter and show progress
         int current_completed;
         #pragma omp atomic capture
@@ -87,47 +291,88 @@ void train_random_forest(RandomForest* rf, Dataset* training_data) {
             }
         }
     }
-    
+
+    omp_set_max_active_levels(saved_levels);
+    print_schedule_stats(rf, tree_times, busy, trees_done, tree_threads,
+                         omp_get_wtime() - start_time);
+    free(order);
+    free(tree_times);
+    free(busy);
+    free(trees_done);
+
+    print_arena_stats(arenas, n_threads);
+    for (int i = 0; i < n_threads; i++) {
+        free_scratch_arena(arenas[i]);
+    }
+    free(arenas);
+
+    // Frozen trees are what inference walks
+    int n_frozen = 0;
+    long node_bytes = 0, flat_bytes = 0;
+    for (int i = 0; i < rf->n_trees; i++) {
+        node_bytes += (long)rf->trees[i].n_nodes * sizeof(TreeNode);
+        if (rf->trees[i].flat) {
+            n_frozen++;
+            flat_bytes += (long)rf->trees[i].n_flat * sizeof(FlatNode);
+        }
+    }
+    printf("Frozen trees: %d/%d, %.1f KB (training layout: %.1f KB)\n",
+           n_frozen, rf->n_trees, flat_bytes / 1024.0, node_bytes / 1024.0);
+    finalize_forest(rf, training_data->n_features);
+
     printf("Random Forest training completed!\n");
 }
 
 int predict_random_forest(RandomForest* rf, double* sample) {
-    int* predictions = malloc(rf->n_trees * sizeof(int));
-    
-    // Get prediction from each tree
-    #pragma omp parallel for schedule(static)
-    for (int i = 0; i < rf->n_trees; i++) {
-        predictions[i] = predict_tree(&rf->trees[i], sample);
-    }
-    
-    // Return majority vote
-    int majority_prediction = get_majority_class(predictions, rf->n_trees);
-    
-    free(predictions);
-    return majority_prediction;
+    int prediction;
+    predict_random_forest_batch(rf, sample, 1, &prediction);
+    return prediction;
 }
 
 double evaluate_accuracy(RandomForest* rf, Dataset* test_data) {
     int correct_predictions = 0;
+    int n = test_data->n_samples;
+    int n_blocks = (n + PREDICT_BLOCK_SAMPLES - 1) / PREDICT_BLOCK_SAMPLES;
     
-    printf("Evaluating accuracy on %d samples...\n", test_data->n_samples);
+    printf("Evaluating accuracy on %d samples...\n", n);
     
-    #pragma omp parallel for reduction(+:correct_predictions)
-    for (int i = 0; i < test_data->n_samples; i++) {
-        int prediction = predict_random_forest(rf, test_data->features[i]);
-        if (prediction == test_data->labels[i]) {
-            correct_predictions++;
-        }
+    #pragma omp parallel
+    {
+        // Features are stored by column; gather each block into rows
+        double* rows = malloc((size_t)PREDICT_BLOCK_SAMPLES * test_data->n_features * sizeof(double));
+        int* votes = malloc((size_t)PREDICT_BLOCK_SAMPLES * rf->n_classes * sizeof(int));
+        int predictions[PREDICT_BLOCK_SAMPLES];
         
-        // Progress indicator for large datasets
-        if (test_data->n_samples > 1000 && i % (test_data->n_samples / 10) == 0) {
-            printf("  Evaluated %d/%d samples\n", i, test_data->n_samples);
+        #pragma omp for schedule(dynamic) reduction(+:correct_predictions)
+        for (int b = 0; b < n_blocks; b++) {
+            int first = b * PREDICT_BLOCK_SAMPLES;
+            int count = n - first < PREDICT_BLOCK_SAMPLES ? n - first : PREDICT_BLOCK_SAMPLES;
+            for (int s = 0; s < count; s++) {
+                get_sample(test_data, first + s, &rows[(size_t)s * test_data->n_features]);
+            }
+            predict_forest_block(rf, rows, count, votes, predictions);
+            for (int s = 0; s < count; s++) {
+                if (predictions[s] == test_data->labels[first + s]) {
+                    correct_predictions++;
+                }
+            }
+            
+            // Progress indicator for large datasets
+            if (n > 1000) {
+                int step = n / 10;
+                for (int i = (first + step - 1) / step * step; i < first + count; i += step) {
+                    printf("  Evaluated %d/%d samples\n", i, n);
+                }
+            }
         }
+        
+        free(rows);
+        free(votes);
     }
     
-    double accuracy = (double)correct_predictions / test_data->n_samples;
+    double accuracy = (double)correct_predictions / n;
     printf("Accuracy: %.2f%% (%d/%d correct)\n", 
-           accuracy * 100.0, correct_predictions, test_data->n_samples);
+           accuracy * 100.0, correct_predictions, n);
     
     return accuracy;
 }
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200112L  // posix_memalign
 #include "random_forest.h"
 
 DecisionTree* create_decision_tree(int max_depth, int min_samples_split) {
@@ -5,12 +6,15 @@ DecisionTree* create_decision_tree(int max_depth, int min_samples_split) {
     tree->capacity = 1000; // Initial capacity
     tree->nodes = malloc(tree->capacity * sizeof(TreeNode));
     tree->n_nodes = 0;
+    tree->flat = NULL;
+    tree->n_flat = 0;
     return tree;
 }
 
 void free_decision_tree(DecisionTree* tree) {
     if (!tree) return;
     free(tree->nodes);
+    free(tree->flat);
     free(tree);
 }
 
@@ -24,9 +28,7 @@ double calculate_gini_impurity(int* labels, int n_samples) {
     }
     
     int* counts = calloc(max_label + 1, sizeof(int));
-    for (int i = 0; i < n_samples; i++) {
-        counts[labels[i]]++;
-    }
+    get_split_kernels()->count_classes(labels, n_samples, max_label + 1, counts);
     
     // Calculate Gini impurity
     double gini = 1.0;
@@ -41,182 +43,974 @@ double calculate_gini_impurity(int* labels, int n_samples) {
     return gini;
 }
 
-int find_best_split(Dataset* data, int* indices, int n_samples, int* feature_indices, 
-                   int n_features, int* best_feature, double* best_threshold) {
+SampleIndex* create_sample_index(Dataset* data, int* rows, int n_rows, int* feature_indices,
+                                 int n_features, int n_classes, ScratchArena* arena) {
+    int n = n_rows;
+    SampleIndex* index = arena_alloc(arena, sizeof(SampleIndex));
+    // The histogram search only needs the node's samples, in any order
+    index->n_orders = data->binned ? 1 : n_features;
+    index->n_samples = n;
+    index->n_classes = n_classes;
+    index->order = arena_alloc(arena, index->n_orders * sizeof(int*));
+    index->labels = arena_alloc(arena, n * sizeof(int));
+    index->goes_left = arena_alloc(arena, data->n_samples * sizeof(int));
+    index->buffer = arena_alloc(arena, n * sizeof(int));
+    index->values = arena_alloc(arena, n * sizeof(double));
+    index->flags = arena_alloc(arena, n * sizeof(uint8_t));
+    index->kernels = get_split_kernels();
     
-    if (n_samples < 2) return 0;
+    for (int f = 0; f < index->n_orders; f++) {
+        index->order[f] = arena_alloc(arena, n * sizeof(int));
+        memcpy(index->order[f], rows, n * sizeof(int));
+    }
+    if (data->binned) {
+        for (int i = 0; i < n; i++) {
+            index->labels[i] = data->labels[rows[i]];
+        }
+        return index;
+    }
     
-    double best_gini = 1.0;
-    *best_feature = -1;
-    *best_threshold = 0.0;
+    // Sort every selected feature once; nodes only partition these orders
+    size_t mark = arena_mark(arena);
+    double* keys = arena_alloc(arena, n * sizeof(double));
+    for (int f = 0; f < n_features; f++) {
+        gather_feature(data, feature_indices[f], rows, n, keys);
+        merge_sort_by_key(keys, index->order[f], n, arena);
+    }
+    arena_release(arena, mark);
+    
+    for (int i = 0; i < n; i++) {
+        index->labels[i] = data->labels[index->order[0][i]];
+    }
+    
+    return index;
+}
+
+// Splits the node range [begin, end) so that samples going left come first
+// in every order array. The partition is stable, so each order stays sorted.
+// Scratch is indexed by position inside [begin, end), so disjoint nodes can
+// be partitioned concurrently. Returns the number of samples sent left.
+int partition_sample_index(SampleIndex* index, Dataset* data, int begin, int end,
+                           int feature, double threshold) {
+    int* first = index->order[0];
+    double* values = &index->values[begin];
+    uint8_t* flags = &index->flags[begin];
+    int* buffer = &index->buffer[begin];
+    int n_samples = end - begin;
     
-    // Calculate current gini impurity
-    int* current_labels = malloc(n_samples * sizeof(int));
+    // Gather the split feature once, then compare it with the SIMD kernel
+    gather_feature(data, feature, &first[begin], n_samples, values);
+    int left_count = index->kernels->partition(values, n_samples, threshold, flags);
     for (int i = 0; i < n_samples; i++) {
-        current_labels[i] = data->labels[indices[i]];
+        index->goes_left[first[begin + i]] = flags[i];
     }
-    double current_gini = calculate_gini_impurity(current_labels, n_samples);
     
-    // Try each feature
+    // The labels follow order[0], whose flags the kernel just produced
+    int* labels = index->labels;
+    int l = begin, r = 0;
+    for (int i = 0; i < n_samples; i++) {
+        if (flags[i]) {
+            labels[l++] = labels[begin + i];
+        } else {
+            buffer[r++] = labels[begin + i];
+        }
+    }
+    memcpy(&labels[l], buffer, r * sizeof(int));
+    
+    for (int f = 0; f < index->n_orders; f++) {
+        int* order = index->order[f];
+        int l = begin, r = 0;
+        
+        for (int i = begin; i < end; i++) {
+            int sample = order[i];
+            if (index->goes_left[sample]) {
+                order[l++] = sample;
+            } else {
+                buffer[r++] = sample;
+            }
+        }
+        memcpy(&order[l], buffer, r * sizeof(int));
+    }
+    
+    return left_count;
+}
+
+HistogramPool* create_histogram_pool(int n_features, int max_bins, int n_classes, int n_slots,
+                                     ScratchArena* arena) {
+    HistogramPool* pool = arena_alloc(arena, sizeof(HistogramPool));
+    pool->stride = max_bins * n_classes;
+    pool->size = n_features * pool->stride;
+    pool->n_slots = n_slots;
+    pool->n_free = n_slots;
+    pool->data = arena_alloc(arena, (size_t)n_slots * pool->size * sizeof(int));
+    pool->free_slots = arena_alloc(arena, n_slots * sizeof(int));
+    
+    for (int i = 0; i < n_slots; i++) {
+        pool->free_slots[i] = n_slots - 1 - i;
+    }
+    
+    return pool;
+}
+
+// Returns NULL when the pool is exhausted; callers then fall back to
+// building each feature's histogram on the fly
+int* acquire_histogram(HistogramPool* pool) {
+    if (!pool || pool->n_free == 0) return NULL;
+    int slot = pool->free_slots[--pool->n_free];
+    return &pool->data[(size_t)slot * pool->size];
+}
+
+void release_histogram(HistogramPool* pool, int* hist) {
+    if (!pool || !hist) return;
+    pool->free_slots[pool->n_free++] = (int)((hist - pool->data) / pool->size);
+}
+
+// Scans the node's samples once and fills the class-count histogram of every
+// selected feature
+void build_node_histogram(Dataset* data, SampleIndex* index, int begin, int end,
+                          int* feature_indices, int n_features, HistogramPool* pool, int* hist,
+                          int n_threads) {
+    (void)n_threads;  // The sequential build has no team
+    int n_classes = index->n_classes;
+    int* order = index->order[0];
+    int* labels = index->labels;
+    
     for (int f = 0; f < n_features; f++) {
         int feature_idx = feature_indices[f];
+        uint8_t* codes = &data->binned[(size_t)feature_idx * data->stride];
+        int* feature_hist = &hist[f * pool->stride];
+        memset(feature_hist, 0, pool->stride * sizeof(int));
+        
+        for (int i = begin; i < end; i++) {
+            feature_hist[codes[order[i]] * n_classes + labels[i]]++;
+        }
+    }
+}
+
+// Evaluates every threshold of one presorted feature in a single sweep.
+// The node's values and labels are gathered into contiguous scratch arrays
+// in sorted order, and the split kernel scores all candidate thresholds.
+// The score sum(left^2)/n_left + sum(right^2)/n_right equals
+// n_samples * (1 - weighted_gini), so a larger score is a better split.
+// Returns -1.0 if no threshold leaves min_leaf samples on both sides.
+static double sweep_sorted_feature(Dataset* data, int* order, int begin, int end,
+                                   int feature_idx, int* node_counts, int* left_counts,
+                                   int n_classes, int min_leaf, const SplitKernels* kernels,
+                                   double* values, int* labels, double* sq, double* threshold) {
+    int n_samples = end - begin;
+    
+    gather_feature(data, feature_idx, &order[begin], n_samples, values);
+    for (int i = 0; i < n_samples; i++) {
+        labels[i] = data->labels[order[begin + i]];
+    }
+    
+    double best_score;
+    int best = kernels->best_split(values, labels, n_samples, node_counts, n_classes,
+                                   min_leaf, left_counts, sq, &best_score);
+    if (best < 0) return -1.0;
+    
+    *threshold = (values[best] + values[best + 1]) / 2.0;
+    // Adjacent doubles can round the midpoint up to the next value
+    if (*threshold >= values[best + 1]) *threshold = values[best];
+    
+    return best_score;
+}
+
+// Evaluates the split after every non-empty bin of a class-count histogram
+// laid out as hist[bin * n_classes + class]. Uses the same score as
+// sweep_sorted_feature; costs O(n_bins * n_classes).
+static double sweep_histogram(int* hist, int n_bins, double* edges, int* node_counts,
+                              int* left_counts, int n_classes, int n_samples, int min_leaf,
+                              double* threshold) {
+    int left_count = 0;
+    double best_score = -1.0;
+    
+    for (int c = 0; c < n_classes; c++) {
+        left_counts[c] = 0;
+    }
+    
+    for (int b = 0; b < n_bins - 1; b++) {
+        int* bin = &hist[b * n_classes];
+        int bin_count = 0;
+        for (int c = 0; c < n_classes; c++) {
+            left_counts[c] += bin[c];
+            bin_count += bin[c];
+        }
+        if (bin_count == 0) continue; // Same partition as the previous bin
+        
+        left_count += bin_count;
+        if (n_samples - left_count < min_leaf) break;
+        if (left_count < min_leaf) continue;
         
-        // Create array of feature values for current samples
-        double* values = malloc(n_samples * sizeof(double));
-        for (int i = 0; i < n_samples; i++) {
-            values[i] = data->features[indices[i]][feature_idx];
+        long long left_sq = 0, right_sq = 0;
+        for (int c = 0; c < n_classes; c++) {
+            int right = node_counts[c] - left_counts[c];
+            left_sq += (long long)left_counts[c] * left_counts[c];
+            right_sq += (long long)right * right;
         }
         
-        // Sort values to find potential split points
-        merge_sort(values, n_samples);
+        int right_count = n_samples - left_count;
+        double score = (double)left_sq / left_count + (double)right_sq / right_count;
         
-        // Try each potential split point
-        for (int i = 0; i < n_samples - 1; i++) {
-            if (values[i] == values[i + 1]) continue; // Skip identical values
+        if (score > best_score) {
+            best_score = score;
+            *threshold = edges[b];
+        }
+    }
+    
+    return best_score;
+}
+
+// Builds the class-count histogram of one binned feature over the node and
+// sweeps its bins. Costs O(n_node + n_bins * n_classes).
+static double sweep_binned_feature(Dataset* data, SampleIndex* index, int begin, int end,
+                                   int feature_idx, int* node_counts, int* hist,
+                                   int* left_counts, int n_classes, int min_leaf,
+                                   double* threshold) {
+    int n_bins = data->bins->n_bins[feature_idx];
+    int* order = index->order[0];
+    uint8_t* codes = &data->binned[(size_t)feature_idx * data->stride];
+    memset(hist, 0, n_bins * n_classes * sizeof(int));
+    
+    for (int i = begin; i < end; i++) {
+        hist[codes[order[i]] * n_classes + index->labels[i]]++;
+    }
+    
+    return sweep_histogram(hist, n_bins, data->bins->edges[feature_idx], node_counts,
+                           left_counts, n_classes, end - begin, min_leaf, threshold);
+}
+
+// Returns 1 if the best split improves the Gini impurity by at least min_gain
+// in score units; best_gain receives the improvement.
+int find_best_split(Dataset* data, SampleIndex* index, int begin, int end, int* feature_indices,
+                   int n_features, HistogramPool* pool, int* node_hist, ScratchArena* arena,
+                   int n_threads, int min_samples_leaf, double min_gain, int* best_feature,
+                   double* best_threshold, double* best_gain) {
+    (void)n_threads;  // The sequential build has no team
+    
+    int n_samples = end - begin;
+    if (n_samples < 2) return 0;
+    
+    int n_classes = index->n_classes;
+    double best_score = -1.0;
+    int best_f = -1;
+    *best_feature = -1;
+    *best_threshold = 0.0;
+    *best_gain = 0.0;
+    
+    size_t mark = arena_mark(arena);
+    
+    // Class counts of the whole node; every sweep starts from them
+    int* node_counts = arena_calloc(arena, n_classes * sizeof(int));
+    index->kernels->count_classes(&index->labels[begin], n_samples, n_classes, node_counts);
+    long long node_sq = 0;
+    for (int c = 0; c < n_classes; c++) {
+        node_sq += (long long)node_counts[c] * node_counts[c];
+    }
+    double current_score = (double)node_sq / n_samples;
+    
+    // Try each feature
+    int* left_counts = arena_alloc(arena, n_classes * sizeof(int));
+    int* hist = NULL;
+    double* values = NULL;
+    int* labels = NULL;
+    double* sq = NULL;
+    if (data->binned && !node_hist) {
+        hist = arena_alloc(arena, MAX_BINS * n_classes * sizeof(int));
+    }
+    if (!data->binned) {
+        values = arena_alloc(arena, n_samples * sizeof(double));
+        labels = arena_alloc(arena, n_samples * sizeof(int));
+        sq = arena_alloc(arena, 2 * n_samples * sizeof(double));
+    }
+    for (int f = 0; f < n_features; f++) {
+        double threshold = 0.0;
+        double score;
+        if (data->binned) {
+            if (node_hist) {
+                int feature_idx = feature_indices[f];
+                score = sweep_histogram(&node_hist[f * pool->stride], data->bins->n_bins[feature_idx],
+                                        data->bins->edges[feature_idx], node_counts, left_counts,
+                                        n_classes, n_samples, min_samples_leaf, &threshold);
+            } else {
+                score = sweep_binned_feature(data, index, begin, end,
+                                             feature_indices[f], node_counts, hist,
+                                             left_counts, n_classes, min_samples_leaf,
+                                             &threshold);
+            }
+        } else {
+            score = sweep_sorted_feature(data, index->order[f], begin, end,
+                                         feature_indices[f], node_counts, left_counts,
+                                         n_classes, min_samples_leaf, index->kernels,
+                                         values, labels, sq, &threshold);
+        }
+        if (score > best_score) {
+            best_score = score;
+            best_f = f;
+            *best_threshold = threshold;
+        }
+    }
+    
+    arena_release(arena, mark);
+    
+    if (best_f == -1) return 0;
+    *best_feature = feature_indices[best_f];
+    *best_gain = best_score - current_score;
+    
+    // The relative guard rejects splits that only gain rounding noise
+    return best_score > current_score * (1.0 + 1e-12) && *best_gain >= min_gain;
+}
+
+// Appends an uninitialized node to the buffer and returns its index
+static int push_node(DecisionTree* out) {
+    if (out->n_nodes >= out->capacity) {
+        out->capacity = out->capacity > 0 ? out->capacity * 2 : 64;
+        out->nodes = realloc(out->nodes, out->capacity * sizeof(TreeNode));
+    }
+    return out->n_nodes++;
+}
+
+static ScratchArena* builder_arena(TreeBuilder* builder) {
+    ScratchArena* arena = builder->arenas[0];
+    arena_reserve(arena, builder->scratch_bytes);
+    return arena;
+}
+
+// Grows the subtree of the node range [begin, end) into out and returns the
+// index of its root. Children are linked once they exist, so a node's
+// subtree can never overwrite its sibling's slot.
+// In binned mode each node owns a histogram from the pool (node_hist). It is
+// either inherited from the parent or built here from the node's samples.
+// When splitting, only the smaller child is rescanned; the parent histogram
+// minus the smaller child's becomes the larger child's histogram.
+int build_tree_recursive(TreeBuilder* builder, DecisionTree* out, int begin, int end,
+                         int* node_hist, int depth) {
+    
+    Dataset* data = builder->data;
+    SampleIndex* index = builder->index;
+    HistogramPool* pool = builder->pool;
+    int n_samples = end - begin;
+    
+    int node_idx = push_node(out);
+    TreeNode* node = &out->nodes[node_idx];
+    node->feature_index = -1;
+    node->threshold = 0.0;
+    node->left_child = -1;
+    node->right_child = -1;
+    node->is_leaf = 1;
+    
+    // The node's labels are read in place through its range. The counts live
+    // until the subtree is done, so the arena usage follows the recursion
+    // like a stack.
+    ScratchArena* arena = builder_arena(builder);
+    size_t mark = arena_mark(arena);
+    int* counts = arena_calloc(arena, index->n_classes * sizeof(int));
+    index->kernels->count_classes(&index->labels[begin], n_samples, index->n_classes, counts);
+    int majority = 0;
+    for (int c = 1; c < index->n_classes; c++) {
+        if (counts[c] > counts[majority]) majority = c;
+    }
+    node->prediction = majority;
+    
+    // Check stopping criteria (a single class present means gini == 0)
+    if (depth >= builder->max_depth || n_samples < builder->min_samples_split || 
+        counts[majority] == n_samples) {
+        release_histogram(pool, node_hist);
+        arena_release(arena, mark);
+        return node_idx;
+    }
+    
+    // Nodes that did not inherit a histogram build their own if a slot is free
+    if (pool && !node_hist) {
+        node_hist = acquire_histogram(pool);
+        if (node_hist) {
+            build_node_histogram(data, index, begin, end, builder->feature_indices,
+                                 builder->n_features, pool, node_hist, 1);
+        }
+    }
+    
+    // Find best split
+    int best_feature;
+    double best_threshold, best_gain;
+    if (!find_best_split(data, index, begin, end, builder->feature_indices, builder->n_features,
+                        pool, node_hist, arena, 1, builder->min_samples_leaf, builder->min_gain,
+                        &best_feature, &best_threshold, &best_gain)) {
+        // No good split found, keep the leaf
+        release_histogram(pool, node_hist);
+        arena_release(arena, mark);
+        return node_idx;
+    }
+    
+    node->feature_index = best_feature;
+    node->threshold = best_threshold;
+    node->is_leaf = 0;
+    
+    // Split samples; the children own consecutive halves of the node range
+    int left_count = partition_sample_index(index, data, begin, end, best_feature, best_threshold);
+    int right_count = n_samples - left_count;
+    
+    // Histogram subtraction: scan only the smaller child. Children at the
+    // depth limit become leaves and never look at a histogram.
+    int* left_hist = NULL;
+    int* right_hist = NULL;
+    if (node_hist) {
+        int* small_hist = depth + 1 < builder->max_depth ? acquire_histogram(pool) : NULL;
+        if (small_hist) {
+            int left_smaller = left_count <= right_count;
+            int small_begin = left_smaller ? begin : begin + left_count;
+            int small_end = left_smaller ? begin + left_count : end;
             
-            double threshold = (values[i] + values[i + 1]) / 2.0;
+            build_node_histogram(data, index, small_begin, small_end, builder->feature_indices,
+                                 builder->n_features, pool, small_hist, 1);
+            for (int i = 0; i < pool->size; i++) {
+                node_hist[i] -= small_hist[i];
+            }
             
-            // Split samples
-            int* left_labels = malloc(n_samples * sizeof(int));
-            int* right_labels = malloc(n_samples * sizeof(int));
-            int left_count = 0, right_count = 0;
+            left_hist = left_smaller ? small_hist : node_hist;
+            right_hist = left_smaller ? node_hist : small_hist;
+        } else {
+            release_histogram(pool, node_hist);
+        }
+    }
+    
+    // Recursively build children
+    int left_child_idx, right_child_idx;
+    left_child_idx = build_tree_recursive(builder, out, begin, begin + left_count,
+                                          left_hist, depth + 1);
+    right_child_idx = build_tree_recursive(builder, out, begin + left_count, end,
+                                           right_hist, depth + 1);
+    
+    // The buffer may have moved while the children were added
+    out->nodes[node_idx].left_child = left_child_idx;
+    out->nodes[node_idx].right_child = right_child_idx;
+    
+    arena_release(arena, mark);
+    return node_idx;
+}
+
+// Level-wise growth processes a whole depth level at once. The frontier
+// nodes own disjoint ranges of the sample index in ascending order, so every
+// pass of a level streams the order arrays from front to back a single time
+// instead of revisiting them node by node. The splits are chosen with the same
+// sweeps and tie-breaks as find_best_split, so both growth strategies produce
+// the same tree; only the node numbering differs (breadth-first here).
+
+// Largest number of nodes a level can hold
+static int max_frontier_size(int n_samples, int max_depth) {
+    if (max_depth >= 30 || (1 << max_depth) > n_samples) return n_samples > 0 ? n_samples : 1;
+    return 1 << max_depth;
+}
+
+// Class counts of every frontier node in one pass over the labels
+static void count_frontier_classes(SampleIndex* index, FrontierNode* frontier,
+                                   int n_frontier, int* counts) {
+    int n_classes = index->n_classes;
+    memset(counts, 0, (size_t)n_frontier * n_classes * sizeof(int));
+    
+    for (int k = 0; k < n_frontier; k++) {
+        index->kernels->count_classes(&index->labels[frontier[k].begin],
+                                      frontier[k].end - frontier[k].begin, n_classes,
+                                      &counts[k * n_classes]);
+    }
+}
+
+// Scores every (node, feature) pair of the level. Each presorted feature is
+// swept across all nodes in one pass over its order array.
+static void sweep_frontier_sorted(TreeBuilder* builder, FrontierNode* frontier, int n_frontier,
+                                  int* counts, int max_samples, ScratchArena* arena,
+                                  double* scores, double* thresholds) {
+    SampleIndex* index = builder->index;
+    int n_classes = index->n_classes;
+    int n_features = builder->n_features;
+    int* left_counts = arena_alloc(arena, n_classes * sizeof(int));
+    double* values = arena_alloc(arena, max_samples * sizeof(double));
+    int* labels = arena_alloc(arena, max_samples * sizeof(int));
+    double* sq = arena_alloc(arena, 2 * max_samples * sizeof(double));
+    
+    for (int f = 0; f < n_features; f++) {
+        for (int k = 0; k < n_frontier; k++) {
+            double threshold = 0.0;
+            scores[k * n_features + f] =
+                sweep_sorted_feature(builder->data, index->order[f], frontier[k].begin,
+                                     frontier[k].end, builder->feature_indices[f],
+                                     &counts[k * n_classes], left_counts, n_classes,
+                                     builder->min_samples_leaf, index->kernels, values,
+                                     labels, sq, &threshold);
+            thresholds[k * n_features + f] = threshold;
+        }
+    }
+}
+
+// Binned counterpart: the level's histograms are built in batches of at most
+// one pool's worth of nodes, each batch in one pass over its samples
+static void sweep_frontier_binned(TreeBuilder* builder, FrontierNode* frontier, int n_frontier,
+                                  int* counts, ScratchArena* arena,
+                                  double* scores, double* thresholds) {
+    Dataset* data = builder->data;
+    HistogramPool* pool = builder->pool;
+    int* order = builder->index->order[0];
+    int* labels = builder->index->labels;
+    int n_classes = builder->index->n_classes;
+    int n_features = builder->n_features;
+    int** hists = arena_alloc(arena, pool->n_slots * sizeof(int*));
+    int* left_counts = arena_alloc(arena, n_classes * sizeof(int));
+    
+    for (int first = 0; first < n_frontier; first += pool->n_slots) {
+        int n_batch = n_frontier - first < pool->n_slots ? n_frontier - first : pool->n_slots;
+        for (int k = 0; k < n_batch; k++) {
+            hists[k] = acquire_histogram(pool);
+        }
+        
+        for (int f = 0; f < n_features; f++) {
+            int feature_idx = builder->feature_indices[f];
+            uint8_t* codes = &data->binned[(size_t)feature_idx * data->stride];
             
-            for (int j = 0; j < n_samples; j++) {
-                if (data->features[indices[j]][feature_idx] <= threshold) {
-                    left_labels[left_count++] = data->labels[indices[j]];
-                } else {
-                    right_labels[right_count++] = data->labels[indices[j]];
+            for (int k = 0; k < n_batch; k++) {
+                FrontierNode* node = &frontier[first + k];
+                int* feature_hist = &hists[k][f * pool->stride];
+                memset(feature_hist, 0, pool->stride * sizeof(int));
+                for (int i = node->begin; i < node->end; i++) {
+                    feature_hist[codes[order[i]] * n_classes + labels[i]]++;
                 }
             }
             
-            if (left_count == 0 || right_count == 0) {
-                free(left_labels);
-                free(right_labels);
-                continue;
+            for (int k = 0; k < n_batch; k++) {
+                FrontierNode* node = &frontier[first + k];
+                int slot = (first + k) * n_features + f;
+                thresholds[slot] = 0.0;
+                scores[slot] = sweep_histogram(&hists[k][f * pool->stride],
+                                               data->bins->n_bins[feature_idx],
+                                               data->bins->edges[feature_idx],
+                                               &counts[(first + k) * n_classes], left_counts,
+                                               n_classes, node->end - node->begin,
+                                               builder->min_samples_leaf, &thresholds[slot]);
+            }
+        }
+        
+        for (int k = 0; k < n_batch; k++) {
+            release_histogram(pool, hists[k]);
+        }
+    }
+}
+
+// Grows the whole tree breadth-first into out, whose root is node 0
+static void grow_level_wise(TreeBuilder* builder, DecisionTree* out, ScratchArena* arena) {
+    Dataset* data = builder->data;
+    SampleIndex* index = builder->index;
+    int n_classes = index->n_classes;
+    int n_features = builder->n_features;
+    int max_frontier = max_frontier_size(index->n_samples, builder->max_depth);
+    
+    FrontierNode* frontier = arena_alloc(arena, max_frontier * sizeof(FrontierNode));
+    FrontierNode* next = arena_alloc(arena, max_frontier * sizeof(FrontierNode));
+    FrontierNode* splitting = arena_alloc(arena, max_frontier * sizeof(FrontierNode));
+    int* counts = arena_alloc(arena, (size_t)max_frontier * n_classes * sizeof(int));
+    int* left_sizes = arena_alloc(arena, max_frontier * sizeof(int));
+    double* scores = arena_alloc(arena, (size_t)max_frontier * n_features * sizeof(double));
+    double* thresholds = arena_alloc(arena, (size_t)max_frontier * n_features * sizeof(double));
+    
+    frontier[0].begin = 0;
+    frontier[0].end = index->n_samples;
+    frontier[0].node = push_node(out);
+    int n_frontier = 1;
+    
+    for (int depth = 0; n_frontier > 0; depth++) {
+        count_frontier_classes(index, frontier, n_frontier, counts);
+        
+        // Every node starts as a leaf; the ones that may split keep their
+        // counts, compacted to the front in frontier order
+        int n_splitting = 0;
+        int max_samples = 0;
+        for (int k = 0; k < n_frontier; k++) {
+            int* node_counts = &counts[k * n_classes];
+            int n_samples = frontier[k].end - frontier[k].begin;
+            int majority = 0;
+            for (int c = 1; c < n_classes; c++) {
+                if (node_counts[c] > node_counts[majority]) majority = c;
             }
             
-            // Calculate weighted gini impurity
-            double left_gini = calculate_gini_impurity(left_labels, left_count);
-            double right_gini = calculate_gini_impurity(right_labels, right_count);
-            double weighted_gini = (left_count * left_gini + right_count * right_gini) / n_samples;
+            TreeNode* node = &out->nodes[frontier[k].node];
+            node->feature_index = -1;
+            node->threshold = 0.0;
+            node->left_child = -1;
+            node->right_child = -1;
+            node->is_leaf = 1;
+            node->prediction = majority;
+            
+            if (depth >= builder->max_depth || n_samples < builder->min_samples_split ||
+                n_samples < 2 || node_counts[majority] == n_samples) continue;
+            
+            memmove(&counts[n_splitting * n_classes], node_counts, n_classes * sizeof(int));
+            splitting[n_splitting++] = frontier[k];
+            if (n_samples > max_samples) max_samples = n_samples;
+        }
+        
+        size_t mark = arena_mark(arena);
+        if (data->binned) {
+            sweep_frontier_binned(builder, splitting, n_splitting, counts, arena, scores, thresholds);
+        } else {
+            sweep_frontier_sorted(builder, splitting, n_splitting, counts, max_samples, arena,
+                                  scores, thresholds);
+        }
+        arena_release(arena, mark);
+        
+        // Best feature per node, ties to the lowest position as in find_best_split
+        int n_split = 0;
+        for (int k = 0; k < n_splitting; k++) {
+            int n_samples = splitting[k].end - splitting[k].begin;
+            double best_score = -1.0;
+            int best_f = -1;
+            for (int f = 0; f < n_features; f++) {
+                if (scores[k * n_features + f] > best_score) {
+                    best_score = scores[k * n_features + f];
+                    best_f = f;
+                }
+            }
+            if (best_f == -1) continue;
             
-            if (weighted_gini < best_gini) {
-                best_gini = weighted_gini;
-                *best_feature = feature_idx;
-                *best_threshold = threshold;
+            long long node_sq = 0;
+            for (int c = 0; c < n_classes; c++) {
+                node_sq += (long long)counts[k * n_classes + c] * counts[k * n_classes + c];
             }
+            double current_score = (double)node_sq / n_samples;
+            if (!(best_score > current_score * (1.0 + 1e-12)) ||
+                best_score - current_score < builder->min_gain) continue;
+            
+            TreeNode* node = &out->nodes[splitting[k].node];
+            node->feature_index = builder->feature_indices[best_f];
+            node->threshold = thresholds[k * n_features + best_f];
+            node->is_leaf = 0;
+            splitting[n_split++] = splitting[k];
+        }
+        
+        // Split nodes own disjoint ranges, so they are partitioned concurrently
+        for (int k = 0; k < n_split; k++) {
+            TreeNode* node = &out->nodes[splitting[k].node];
+            left_sizes[k] = partition_sample_index(index, data, splitting[k].begin, splitting[k].end,
+                                                   node->feature_index, node->threshold);
+        }
+        
+        // Children are numbered level by level, in the order of their parents
+        n_frontier = 0;
+        for (int k = 0; k < n_split; k++) {
+            int middle = splitting[k].begin + left_sizes[k];
+            int left_child = push_node(out);
+            int right_child = push_node(out);
+            out->nodes[splitting[k].node].left_child = left_child;
+            out->nodes[splitting[k].node].right_child = right_child;
             
-            free(left_labels);
-            free(right_labels);
+            next[n_frontier].begin = splitting[k].begin;
+            next[n_frontier].end = middle;
+            next[n_frontier++].node = left_child;
+            next[n_frontier].begin = middle;
+            next[n_frontier].end = splitting[k].end;
+            next[n_frontier++].node = right_child;
         }
         
-        free(values);
+        FrontierNode* swap = frontier;
+        frontier = next;
+        next = swap;
     }
-    
-    free(current_labels);
-    
-    // Return 1 if we found a valid split that improves gini
-    return (*best_feature != -1 && best_gini < current_gini);
 }
 
-void build_tree_recursive(DecisionTree* tree, Dataset* data, int* indices, int n_samples,
-                         int* feature_indices, int n_features, int depth, int max_depth, 
-                         int min_samples_split, int node_idx) {
+// Best-first growth keeps the splittable leaves in a max-heap ordered by the
+// impurity decrease of their best split and always expands the top one, so
+// a max_leaf_nodes budget is spent on the splits that help the most. Without
+// a budget it grows the same tree as the other strategies. Pending leaves
+// are too many to hold histograms, so binned nodes build theirs per feature.
+
+// Heap order: larger gain first, then the older node for determinism
+static int candidate_before(SplitCandidate* a, SplitCandidate* b) {
+    if (a->gain != b->gain) return a->gain > b->gain;
+    return a->node < b->node;
+}
+
+static void push_candidate(SplitCandidate* heap, int* n_heap, SplitCandidate candidate) {
+    int i = (*n_heap)++;
+    while (i > 0 && candidate_before(&candidate, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = candidate;
+}
+
+static SplitCandidate pop_candidate(SplitCandidate* heap, int* n_heap) {
+    SplitCandidate top = heap[0];
+    SplitCandidate last = heap[--(*n_heap)];
+    int i = 0;
     
-    // Expand tree capacity if needed
-    if (node_idx >= tree->capacity) {
-        tree->capacity *= 2;
-        tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(TreeNode));
+    while (2 * i + 1 < *n_heap) {
+        int child = 2 * i + 1;
+        if (child + 1 < *n_heap && candidate_before(&heap[child + 1], &heap[child])) child++;
+        if (!candidate_before(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
     }
+    if (*n_heap > 0) heap[i] = last;
+    
+    return top;
+}
+
+// Initializes node as a leaf of the range [begin, end) and queues its best
+// split if it has one
+static void evaluate_leaf(TreeBuilder* builder, DecisionTree* out, int node_idx, int begin,
+                          int end, int depth, ScratchArena* arena, SplitCandidate* heap,
+                          int* n_heap) {
+    SampleIndex* index = builder->index;
+    int n_samples = end - begin;
+    size_t mark = arena_mark(arena);
     
-    if (node_idx >= tree->n_nodes) {
-        tree->n_nodes = node_idx + 1;
+    int* counts = arena_calloc(arena, index->n_classes * sizeof(int));
+    index->kernels->count_classes(&index->labels[begin], n_samples, index->n_classes, counts);
+    int majority = 0;
+    for (int c = 1; c < index->n_classes; c++) {
+        if (counts[c] > counts[majority]) majority = c;
     }
     
-    TreeNode* node = &tree->nodes[node_idx];
+    TreeNode* node = &out->nodes[node_idx];
+    node->feature_index = -1;
+    node->threshold = 0.0;
     node->left_child = -1;
     node->right_child = -1;
-    node->is_leaf = 0;
+    node->is_leaf = 1;
+    node->prediction = majority;
     
-    // Create label array for current samples
-    int* labels = malloc(n_samples * sizeof(int));
-    for (int i = 0; i < n_samples; i++) {
-        labels[i] = data->labels[indices[i]];
+    SplitCandidate candidate;
+    if (depth < builder->max_depth && n_samples >= builder->min_samples_split &&
+        counts[majority] != n_samples &&
+        find_best_split(builder->data, index, begin, end, builder->feature_indices,
+                        builder->n_features, NULL, NULL, arena, 1, builder->min_samples_leaf,
+                        builder->min_gain, &candidate.feature, &candidate.threshold,
+                        &candidate.gain)) {
+        candidate.begin = begin;
+        candidate.end = end;
+        candidate.node = node_idx;
+        candidate.depth = depth;
+        push_candidate(heap, n_heap, candidate);
     }
     
-    // Check stopping criteria
-    if (depth >= max_depth || n_samples < min_samples_split || 
-        calculate_gini_impurity(labels, n_samples) == 0.0) {
+    arena_release(arena, mark);
+}
+
+// Largest number of leaves, and so of queued candidates, a tree can have
+static int max_leaf_count(int n_samples, int max_leaf_nodes) {
+    if (n_samples < 1) n_samples = 1;
+    if (max_leaf_nodes > 0 && max_leaf_nodes < n_samples) return max_leaf_nodes;
+    return n_samples;
+}
+
+// Grows the whole tree best-first into out, whose root is node 0
+static void grow_best_first(TreeBuilder* builder, DecisionTree* out, ScratchArena* arena) {
+    int n_samples = builder->index->n_samples;
+    SplitCandidate* heap = arena_alloc(arena, max_leaf_count(n_samples, builder->max_leaf_nodes) *
+                                              sizeof(SplitCandidate));
+    int n_heap = 0;
+    int n_leaves = 1;
+    
+    evaluate_leaf(builder, out, push_node(out), 0, n_samples, 0, arena, heap, &n_heap);
+    
+    while (n_heap > 0 && (builder->max_leaf_nodes == 0 || n_leaves < builder->max_leaf_nodes)) {
+        SplitCandidate split = pop_candidate(heap, &n_heap);
+        
+        TreeNode* node = &out->nodes[split.node];
+        node->feature_index = split.feature;
+        node->threshold = split.threshold;
+        node->is_leaf = 0;
+        
+        int middle = split.begin + partition_sample_index(builder->index, builder->data,
+                                                          split.begin, split.end,
+                                                          split.feature, split.threshold);
+        int left_child = push_node(out);
+        int right_child = push_node(out);
+        out->nodes[split.node].left_child = left_child;
+        out->nodes[split.node].right_child = right_child;
+        n_leaves++;
         
-        // Create leaf node
-        node->is_leaf = 1;
-        node->prediction = get_majority_class(labels, n_samples);
-        free(labels);
-        return;
+        evaluate_leaf(builder, out, left_child, split.begin, middle, split.depth + 1, arena,
+                      heap, &n_heap);
+        evaluate_leaf(builder, out, right_child, middle, split.end, split.depth + 1, arena,
+                      heap, &n_heap);
     }
+}
+
+// Upper bound on the scratch memory one tree needs, so that the arena is
+// sized once per tree and never grows while the tree is being built
+static size_t tree_scratch_bytes(Dataset* data, int n_rows, int n_features, int n_classes,
+                                 int n_slots, int max_depth, int team) {
+    size_t n = n_rows;
+    size_t n_orders = data->binned ? 1 : n_features;
     
-    // Find best split
-    int best_feature;
-    double best_threshold;
-    if (!find_best_split(data, indices, n_samples, feature_indices, n_features, 
-                        &best_feature, &best_threshold)) {
-        // No good split found, create leaf
-        node->is_leaf = 1;
-        node->prediction = get_majority_class(labels, n_samples);
-        free(labels);
-        return;
+    // Sample index, plus the keys and merge buffers of the presort. The side
+    // flags are indexed by row id, so they span the whole training set.
+    size_t bytes = arena_size(sizeof(SampleIndex)) + arena_size(n_orders * sizeof(int*)) +
+                   n_orders * arena_size(n * sizeof(int)) + 2 * arena_size(n * sizeof(int)) +
+                   arena_size(data->n_samples * sizeof(int)) + arena_size(n * sizeof(double)) +
+                   arena_size(n * sizeof(uint8_t));
+    if (!data->binned) {
+        bytes += 2 * arena_size(n * sizeof(double)) + arena_size(n * sizeof(int));
     }
     
-    node->feature_index = best_feature;
-    node->threshold = best_threshold;
+    // Histogram pool
+    if (data->binned) {
+        size_t hist = (size_t)n_features * data->bins->max_bins * n_classes * sizeof(int);
+        bytes += arena_size(sizeof(HistogramPool)) + arena_size(n_slots * hist) +
+                 arena_size(n_slots * sizeof(int));
+    }
     
-    // Split samples
-    int* left_indices = malloc(n_samples * sizeof(int));
-    int* right_indices = malloc(n_samples * sizeof(int));
-    int left_count = 0, right_count = 0;
+    // Class counts held by every level of the recursion
+    size_t levels = (size_t)max_depth < n ? (size_t)max_depth : n;
+    bytes += (levels + 1) * arena_size(n_classes * sizeof(int));
     
-    for (int i = 0; i < n_samples; i++) {
-        if (data->features[indices[i]][best_feature] <= best_threshold) {
-            left_indices[left_count++] = indices[i];
-        } else {
-            right_indices[right_count++] = indices[i];
-        }
+    // find_best_split: node counts, then per-thread sweep scratch
+    bytes += arena_size(n_classes * sizeof(int));
+    bytes += team * (arena_size(n_classes * sizeof(int)) +
+                     arena_size(MAX_BINS * n_classes * sizeof(int)) +
+                     arena_size(n * sizeof(double)) + arena_size(n * sizeof(int)) +
+                     arena_size(2 * n * sizeof(double)));
+    
+    return bytes;
+}
+
+// Extra scratch of the level-wise builder on top of tree_scratch_bytes
+static size_t level_scratch_bytes(Dataset* data, int n_rows, int n_features, int n_classes,
+                                  int n_slots, int max_depth, int team) {
+    size_t n = n_rows;
+    size_t frontier = max_frontier_size(n_rows, max_depth);
+    
+    size_t bytes = 3 * arena_size(frontier * sizeof(FrontierNode)) +
+                   arena_size(frontier * n_classes * sizeof(int)) +
+                   arena_size(frontier * sizeof(int)) +
+                   2 * arena_size(frontier * n_features * sizeof(double));
+    
+    // Per-level sweep scratch
+    if (data->binned) {
+        bytes += arena_size(n_slots * sizeof(int*)) + team * arena_size(n_classes * sizeof(int));
+    } else {
+        bytes += team * (arena_size(n_classes * sizeof(int)) + arena_size(n * sizeof(double)) +
+                         arena_size(n * sizeof(int)) + arena_size(2 * n * sizeof(double)));
+    }
+    
+    return bytes;
+}
+
+// Trains tree on the n_rows training rows listed in rows, typically a
+// bootstrap drawn with replacement; the rows are never copied
+void train_decision_tree(DecisionTree* tree, Dataset* data, int* rows, int n_rows,
+                         int* feature_indices, int n_features, TreeParams* params,
+                         ScratchArena** arenas) {
+    // Labels are dense class ids, so the largest one bounds the count arrays
+    int max_label = 0;
+    for (int i = 0; i < n_rows; i++) {
+        if (data->labels[rows[i]] > max_label) max_label = data->labels[rows[i]];
     }
+    int n_classes = max_label + 1;
+    int n_slots = params->max_depth < MAX_HISTOGRAM_SLOTS - 2 ? params->max_depth + 2
+                                                              : MAX_HISTOGRAM_SLOTS;
+    // A leaf budget is only meaningful when the best leaves are split first
+    int growth = params->max_leaf_nodes > 0 ? GROWTH_BEST_FIRST : params->growth;
     
-    // Create child nodes
-    int left_child_idx = tree->n_nodes;
-    int right_child_idx = tree->n_nodes + 1;
+    TreeBuilder builder;
+    builder.data = data;
+    builder.feature_indices = feature_indices;
+    builder.n_features = n_features;
+    builder.max_depth = params->max_depth;
+    builder.min_samples_split = params->min_samples_split;
+    builder.min_samples_leaf = params->min_samples_leaf > 0 ? params->min_samples_leaf : 1;
+    builder.max_leaf_nodes = params->max_leaf_nodes;
+    // The weighted decrease N_t / N * (gini - weighted child gini) equals the
+    // score gain over N, the tree's sample count
+    builder.min_gain = params->min_impurity_decrease * n_rows;
+    builder.task_cutoff = params->task_cutoff;
+    builder.arenas = arenas;
+    builder.scratch_bytes = tree_scratch_bytes(data, n_rows, n_features, n_classes, n_slots,
+                                               params->max_depth, 1);
+    if (growth == GROWTH_LEVEL_WISE) {
+        builder.scratch_bytes += level_scratch_bytes(data, n_rows, n_features, n_classes, n_slots,
+                                                     params->max_depth, 1);
+    } else if (growth == GROWTH_BEST_FIRST) {
+        builder.scratch_bytes += arena_size(max_leaf_count(n_rows, params->max_leaf_nodes) *
+                                            sizeof(SplitCandidate));
+    }
     
-    node->left_child = left_child_idx;
-    node->right_child = right_child_idx;
+    // All temporaries of this tree come from the arenas from here on
+    ScratchArena* arena = builder_arena(&builder);
+    size_t mark = arena_mark(arena);
     
-    // Recursively build children
-    build_tree_recursive(tree, data, left_indices, left_count, feature_indices, 
-                        n_features, depth + 1, max_depth, min_samples_split, left_child_idx);
+    // Sort the selected features once for the whole tree
+    builder.index = create_sample_index(data, rows, n_rows, feature_indices, n_features, n_classes,
+                                        arena);
+    
+    // Binned trees reuse node histograms from a pool bounded by the depth
+    builder.pool = NULL;
+    if (data->binned && growth != GROWTH_BEST_FIRST) {
+        builder.pool = create_histogram_pool(n_features, data->bins->max_bins, n_classes,
+                                             n_slots, arena);
+    }
     
-    build_tree_recursive(tree, data, right_indices, right_count, feature_indices, 
-                        n_features, depth + 1, max_depth, min_samples_split, right_child_idx);
+    // Build tree starting from root, which lands at index 0
+    tree->n_nodes = 0;
+    if (growth == GROWTH_LEVEL_WISE) {
+        grow_level_wise(&builder, tree, arena);
+    } else if (growth == GROWTH_BEST_FIRST) {
+        grow_best_first(&builder, tree, arena);
+    } else {
+        build_tree_recursive(&builder, tree, 0, n_rows, NULL, 0);
+    }
     
-    free(labels);
-    free(left_indices);
-    free(right_indices);
+    arena_release(arena, mark);
 }
 
-void train_decision_tree(DecisionTree* tree, Dataset* data, int* feature_indices, int n_features) {
-    // Create array of all sample indices
-    int* all_indices = malloc(data->n_samples * sizeof(int));
-    for (int i = 0; i < data->n_samples; i++) {
-        all_indices[i] = i;
-    }
+// Converts a trained tree into the compact breadth-first layout that
+// predict_tree walks. The thresholds stay double: the datasets contain values
+// one double step apart, which a float threshold would send the same way.
+int freeze_tree(DecisionTree* tree) {
+    free(tree->flat);
+    tree->flat = NULL;
+    tree->n_flat = 0;
+    if (tree->n_nodes == 0) return 0;
     
-    // Build tree starting from root
-    build_tree_recursive(tree, data, all_indices, data->n_samples, feature_indices, 
-                        n_features, 0, MAX_TREE_DEPTH, MIN_SAMPLES_SPLIT, 0);
+    FlatNode* flat;
+    if (posix_memalign((void**)&flat, 64, tree->n_nodes * sizeof(FlatNode)) != 0) return 0;
+    
+    // Node ids in breadth-first order; a node's children are appended to the
+    // queue together, which makes them adjacent in the frozen tree
+    int* queue = malloc(tree->n_nodes * sizeof(int));
+    int head = 0, tail = 0;
+    queue[tail++] = 0;
+    
+    while (head < tail) {
+        TreeNode* node = &tree->nodes[queue[head]];
+        FlatNode* out = &flat[head];
+        
+        if (node->is_leaf) {
+            out->threshold = 0.0;
+            out->skip = 0;
+            out->value = node->prediction;
+        } else {
+            out->threshold = node->threshold;
+            out->skip = tail - head;
+            out->value = node->feature_index;
+            queue[tail++] = node->left_child;
+            queue[tail++] = node->right_child;
+        }
+        head++;
+    }
+    free(queue);
     
-    free(all_indices);
+    tree->flat = flat;
+    tree->n_flat = tail;
+    return 1;
 }
 
 int predict_tree(DecisionTree* tree, double* sample) {
+    if (tree->flat) {
+        const FlatNode* node = tree->flat;
+        while (node->skip) {
+            node += node->skip + !(sample[node->value] <= node->threshold);
+        }
+        return node->value;
+    }
+    
     if (tree->n_nodes == 0) return 0;
     
     int current_node = 0;
@@ -6,6 +6,23 @@ RandomForest* create_random_forest(int n_trees, int max_depth, int min_samples_s
     rf->max_depth = max_depth;
     rf->min_samples_split = min_samples_split;
     rf->n_features_per_tree = n_features_per_tree;
+    rf->params.max_depth = max_depth;
+    rf->params.min_samples_split = min_samples_split;
+    rf->params.min_samples_leaf = 1;
+    rf->params.max_leaf_nodes = 0;
+    rf->params.min_impurity_decrease = 0.0;
+    rf->params.task_cutoff = DEFAULT_TASK_CUTOFF;
+    rf->params.inner_threads = 0;
+    rf->params.inner_cutoff = DEFAULT_INNER_CUTOFF;
+    rf->params.data_parallel = 0;
+    rf->params.growth = GROWTH_DEPTH_FIRST;
+    rf->seed = 0;
+    rf->schedule = SCHEDULE_STATIC;
+    rf->n_features = 0;
+    rf->n_classes = 1;
+    rf->engine = ENGINE_TREE;
+    rf->quickscorer = NULL;
+    rf->perfect = NULL;
     
     rf->trees = malloc(n_trees * sizeof(DecisionTree));
     
@@ -13,6 +30,8 @@ RandomForest* create_random_forest(int n_trees, int max_depth, int min_samples_s
         rf->trees[i].nodes = NULL;
         rf->trees[i].n_nodes = 0;
         rf->trees[i].capacity = 0;
+        rf->trees[i].flat = NULL;
+        rf->trees[i].n_flat = 0;
     }
     
     return rf;
@@ -26,9 +45,12 @@ void free_random_forest(RandomForest* rf) {
             if (rf->trees[i].nodes) {
                 free(rf->trees[i].nodes);
             }
+            free(rf->trees[i].flat);
         }
         free(rf->trees);
     }
+    free_quickscorer(rf->quickscorer);
+    free_perfect_forest(rf->perfect);
     
     free(rf);
 }
@@ -44,16 +66,22 @@ void train_random_forest(RandomForest* rf, Dataset* training_data) {
     
     printf("Using %d features per tree\n", rf->n_features_per_tree);
     
+    // Scratch arena reused by every tree
+    ScratchArena* arena = create_scratch_arena();
+
     for (int tree_idx = 0; tree_idx < rf->n_trees; tree_idx++) {
         if (tree_idx % 10 == 0) {
             printf("Training tree %d/%d\n", tree_idx + 1, rf->n_trees);
         }
         
-        // Create bootstrap sample
-        Dataset* bootstrap_data = bootstrap_sample(training_data, training_data->n_samples);
+        // The tree's own random stream, the same one the parallel build uses
+        RandomStream rng = random_stream(rf->seed, tree_idx);
         
         // Select random features for this tree
-        int* feature_indices = generate_random_features(training_data->n_features, rf->n_features_per_tree);
+        int* feature_indices = generate_random_features(training_data->n_features, rf->n_features_per_tree, &rng);
+        
+        // Bootstrap as row ids into the shared training set
+        int* rows = bootstrap_sample(training_data, training_data->n_samples, &rng);
         
         // Initialize decision tree
         DecisionTree* tree = &rf->trees[tree_idx];
@@ -62,51 +90,81 @@ void train_random_forest(RandomForest* rf, Dataset* training_data) {
         tree->n_nodes = 0;
         
         // Train the tree
-        train_decision_tree(tree, bootstrap_data, feature_indices, rf->n_features_per_tree);
+        train_decision_tree(tree, training_data, rows, training_data->n_samples, feature_indices,
+                            rf->n_features_per_tree, &rf->params, &arena);
+        freeze_tree(tree);
         
         // Clean up
-        free_dataset(bootstrap_data);
+        free(rows);
         free(feature_indices);
     }
     
+    print_arena_stats(&arena, 1);
+    free_scratch_arena(arena);
+
+    // Frozen trees are what inference walks
+    int n_frozen = 0;
+    long node_bytes = 0, flat_bytes = 0;
+    for (int i = 0; i < rf->n_trees; i++) {
+        node_bytes += (long)rf->trees[i].n_nodes * sizeof(TreeNode);
+        if (rf->trees[i].flat) {
+            n_frozen++;
+            flat_bytes += (long)rf->trees[i].n_flat * sizeof(FlatNode);
+        }
+    }
+    printf("Frozen trees: %d/%d, %.1f KB (training layout: %.1f KB)\n",
+           n_frozen, rf->n_trees, flat_bytes / 1024.0, node_bytes / 1024.0);
+    finalize_forest(rf, training_data->n_features);
+
     printf("Random Forest training completed!\n");
 }
 
 int predict_random_forest(RandomForest* rf, double* sample) {
-    int* predictions = malloc(rf->n_trees * sizeof(int));
-    
-    // Get prediction from each tree
-    for (int i = 0; i < rf->n_trees; i++) {
-        predictions[i] = predict_tree(&rf->trees[i], sample);
-    }
-    
-    // Return majority vote
-    int majority_prediction = get_majority_class(predictions, rf->n_trees);
-    
-    free(predictions);
-    return majority_prediction;
+    int prediction;
+    predict_random_forest_batch(rf, sample, 1, &prediction);
+    return prediction;
 }
 
 double evaluate_accuracy(RandomForest* rf, Dataset* test_data) {
     int correct_predictions = 0;
+    int n = test_data->n_samples;
+    int n_blocks = (n + PREDICT_BLOCK_SAMPLES - 1) / PREDICT_BLOCK_SAMPLES;
+    
+    printf("Evaluating accuracy on %d samples...\n", n);
     
-    printf("Evaluating accuracy on %d samples...\n", test_data->n_samples);
+    // Features are stored by column; gather each block into rows
+    double* rows = malloc((size_t)PREDICT_BLOCK_SAMPLES * test_data->n_features * sizeof(double));
+    int* votes = malloc((size_t)PREDICT_BLOCK_SAMPLES * rf->n_classes * sizeof(int));
+    int predictions[PREDICT_BLOCK_SAMPLES];
     
-    for (int i = 0; i < test_data->n_samples; i++) {
-        int prediction = predict_random_forest(rf, test_data->features[i]);
-        if (prediction == test_data->labels[i]) {
-            correct_predictions++;
+    for (int b = 0; b < n_blocks; b++) {
+        int first = b * PREDICT_BLOCK_SAMPLES;
+        int count = n - first < PREDICT_BLOCK_SAMPLES ? n - first : PREDICT_BLOCK_SAMPLES;
+        for (int s = 0; s < count; s++) {
+            get_sample(test_data, first + s, &rows[(size_t)s * test_data->n_features]);
+        }
+        predict_forest_block(rf, rows, count, votes, predictions);
+        for (int s = 0; s < count; s++) {
+            if (predictions[s] == test_data->labels[first + s]) {
+                correct_predictions++;
+            }
         }
         
         // Progress indicator for large datasets
-        if (test_data->n_samples > 1000 && i % (test_data->n_samples / 10) == 0) {
-            printf("  Evaluated %d/%d samples\n", i, test_data->n_samples);
+        if (n > 1000) {
+            int step = n / 10;
+            for (int i = (first + step - 1) / step * step; i < first + count; i += step) {
+                printf("  Evaluated %d/%d samples\n", i, n);
+            }
         }
     }
     
-    double accuracy = (double)correct_predictions / test_data->n_samples;
+    free(rows);
+    free(votes);
+    
+    double accuracy = (double)correct_predictions / n;
     printf("Accuracy: %.2f%% (%d/%d correct)\n", 
-           accuracy * 100.0, correct_predictions, test_data->n_samples);
+           accuracy * 100.0, correct_predictions, n);
     
     return accuracy;
 }
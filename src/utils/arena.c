@@ -0,0 +1,92 @@
+#include "random_forest.h"
+
+#define ARENA_ALIGNMENT 64  // Cache line, also enough for any SIMD load
+
+ScratchArena* create_scratch_arena(void) {
+    ScratchArena* arena = malloc(sizeof(ScratchArena));
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+    arena->peak = 0;
+    arena->heap_allocations = 0;
+    return arena;
+}
+
+void free_scratch_arena(ScratchArena* arena) {
+    if (!arena) return;
+    free(arena->base);
+    free(arena);
+}
+
+// Makes sure the arena can hold bytes. Only called while the arena is empty
+// (between trees), so growing never invalidates live pointers. Growth keeps
+// some headroom so that slightly larger trees do not reallocate again.
+void arena_reserve(ScratchArena* arena, size_t bytes) {
+    if (bytes <= arena->capacity) return;
+
+    if (arena->used != 0) {
+        fprintf(stderr, "Error: Scratch arena resized while in use\n");
+        abort();
+    }
+
+    size_t capacity = bytes + bytes / 4;
+    free(arena->base);
+    arena->base = malloc(capacity);
+    if (!arena->base) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        abort();
+    }
+    arena->capacity = capacity;
+    arena->heap_allocations++;
+}
+
+void* arena_alloc(ScratchArena* arena, size_t bytes) {
+    size_t offset = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    // The reservation is an upper bound; running past it is a sizing bug
+    if (offset + bytes > arena->capacity) {
+        fprintf(stderr, "Error: Scratch arena exhausted (%zu of %zu bytes)\n",
+                offset + bytes, arena->capacity);
+        abort();
+    }
+
+    arena->used = offset + bytes;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + offset;
+}
+
+void* arena_calloc(ScratchArena* arena, size_t bytes) {
+    void* ptr = arena_alloc(arena, bytes);
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+size_t arena_mark(ScratchArena* arena) {
+    return arena->used;
+}
+
+// Frees everything allocated after mark was taken
+void arena_release(ScratchArena* arena, size_t mark) {
+    arena->used = mark;
+}
+
+// Upper bound on the bytes of one arena_alloc, including alignment padding
+size_t arena_size(size_t bytes) {
+    return bytes + ARENA_ALIGNMENT;
+}
+
+// The first reservation of every arena is its warm-up; any later growth means
+// a tree needed more scratch than the ones before and hit the heap again
+void print_arena_stats(ScratchArena** arenas, int n_arenas) {
+    long total = 0, after_warmup = 0;
+    size_t peak = 0;
+
+    for (int i = 0; i < n_arenas; i++) {
+        total += arenas[i]->heap_allocations;
+        if (arenas[i]->heap_allocations > 1) after_warmup += arenas[i]->heap_allocations - 1;
+        if (arenas[i]->peak > peak) peak = arenas[i]->peak;
+    }
+
+    printf("Scratch arenas: %d, heap allocations: %ld (%ld after warm-up), peak: %.2f MB\n",
+           n_arenas, total, after_warmup, peak / (1024.0 * 1024.0));
+}
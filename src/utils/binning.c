@@ -0,0 +1,94 @@
+#include "random_forest.h"
+#include <float.h>
+
+BinMapper* create_bin_mapper(Dataset* dataset, int max_bins) {
+    if (max_bins > MAX_BINS) max_bins = MAX_BINS;
+    if (max_bins < 2) max_bins = 2;
+
+    BinMapper* bins = malloc(sizeof(BinMapper));
+    bins->n_features = dataset->n_features;
+    bins->max_bins = max_bins;
+    bins->edges = malloc(dataset->n_features * sizeof(double*));
+    bins->n_bins = malloc(dataset->n_features * sizeof(int));
+
+    int n = dataset->n_samples;
+    double* values = malloc(n * sizeof(double));
+
+    for (int f = 0; f < dataset->n_features; f++) {
+        bins->edges[f] = malloc(max_bins * sizeof(double));
+
+        memcpy(values, &dataset->features[(size_t)f * dataset->stride], n * sizeof(double));
+        merge_sort(values, n);
+
+        int n_distinct = n > 0 ? 1 : 0;
+        for (int i = 1; i < n; i++) {
+            if (values[i] != values[i - 1]) n_distinct++;
+        }
+
+        // With few distinct values every value gets its own bin and the edges
+        // are the exact midpoints; otherwise walk the distinct values and close
+        // a bin once it holds its share of the rows still unbinned, split over
+        // the bins still left. The share is recomputed after every bin, so a
+        // heavy repeated value only enlarges its own bin instead of leaving
+        // the following values one bin each until fixed quantiles catch up.
+        int n_bins = 0;
+        int bin_start = 0;
+        for (int i = 0; i + 1 < n && n_bins < max_bins - 1; i++) {
+            if (values[i] == values[i + 1]) continue;
+
+            long long in_bin = (long long)(i + 1 - bin_start) * (max_bins - n_bins);
+            if (n_distinct <= max_bins || in_bin >= n - bin_start) {
+                bins->edges[f][n_bins++] = (values[i] + values[i + 1]) / 2.0;
+                bin_start = i + 1;
+            }
+        }
+        bins->edges[f][n_bins++] = DBL_MAX;
+        bins->n_bins[f] = n_bins;
+    }
+
+    free(values);
+    return bins;
+}
+
+void free_bin_mapper(BinMapper* bins) {
+    if (!bins) return;
+
+    for (int f = 0; f < bins->n_features; f++) {
+        free(bins->edges[f]);
+    }
+    free(bins->edges);
+    free(bins->n_bins);
+    free(bins);
+}
+
+int find_bin(BinMapper* bins, int feature, double value) {
+    double* edges = bins->edges[feature];
+    int lo = 0, hi = bins->n_bins[feature] - 1;
+
+    // First bin whose upper edge is >= value
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (value <= edges[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+void bin_dataset(Dataset* dataset, BinMapper* bins) {
+    dataset->bins = bins;
+    dataset->binned = malloc_aligned((size_t)dataset->n_features * dataset->stride);
+
+    for (int f = 0; f < dataset->n_features; f++) {
+        double* values = &dataset->features[(size_t)f * dataset->stride];
+        uint8_t* binned = &dataset->binned[(size_t)f * dataset->stride];
+        for (int i = 0; i < dataset->n_samples; i++) {
+            binned[i] = (uint8_t)find_bin(bins, f, values[i]);
+        }
+    }
+
+    printf("Binned dataset: %d features into at most %d bins\n",
+           dataset->n_features, bins->max_bins);
+}
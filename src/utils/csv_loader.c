@@ -0,0 +1,312 @@
+#define _POSIX_C_SOURCE 200112L  // mmap, posix_madvise
+#include "random_forest.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The file is mapped and split into newline-aligned chunks. Rows are counted
+// per chunk, the counts are turned into row offsets, and every chunk then
+// parses its rows straight into the dataset's columns. Chunks are a fixed
+// size, so the result does not depend on the number of threads.
+
+#define LOAD_CHUNK_BYTES (1 << 20)
+#define MAX_FAST_DIGITS 19  // Decimal digits that always fit in a uint64_t
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    int first_row;
+    int n_rows;
+    int bad_row;      // First row with too few fields, -1 if none
+} LoadChunk;
+
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int is_field_end(const char* p, const char* end) {
+    return p == end || *p == ',' || *p == '\n' || *p == '\r';
+}
+
+// Length of a line without its line terminator
+static const char* line_content_end(const char* line, const char* line_end) {
+    if (line_end > line && line_end[-1] == '\r') line_end--;
+    return line_end;
+}
+
+static const char* next_line(const char* p, const char* end) {
+    const char* newline = memchr(p, '\n', end - p);
+    return newline ? newline : end;
+}
+
+// strtod on a copy of the field, for everything the fast path rejects
+static double parse_double_slow(const char* p, const char* end) {
+    char local[64];
+    size_t length = 0;
+    while (!is_field_end(p + length, end)) length++;
+
+    char* field = length < sizeof(local) ? local : malloc(length + 1);
+    memcpy(field, p, length);
+    field[length] = '\0';
+    double value = strtod(field, NULL);
+    if (field != local) free(field);
+    return value;
+}
+
+// Parses the decimal number at p, with the same result as atof. Numbers
+// with at most 19 significant digits and a small exponent are converted with
+// a single exact multiply or divide, which IEEE rounding makes correctly
+// rounded (Clinger's fast path); anything else goes through strtod.
+static double parse_double(const char* p, const char* end) {
+    const char* start = p;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;   // Significant digits, leading zeros excluded
+    int exponent = 0;
+    int any_digit = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any_digit = 1;
+        if (mantissa == 0 && *p == '0') continue;
+        if (++n_digits > MAX_FAST_DIGITS) return parse_double_slow(start, end);
+        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any_digit = 1;
+            exponent--;
+            if (mantissa == 0 && *p == '0') continue;
+            if (++n_digits > MAX_FAST_DIGITS) return parse_double_slow(start, end);
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        }
+    }
+    if (!any_digit) return parse_double_slow(start, end);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        int exp_negative = 0;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exp_negative = *q == '-';
+            q++;
+        }
+        if (q == end || *q < '0' || *q > '9') return parse_double_slow(start, end);
+        int value = 0;
+        for (; q < end && *q >= '0' && *q <= '9'; q++) {
+            if (value > 10000) return parse_double_slow(start, end);
+            value = value * 10 + (*q - '0');
+        }
+        exponent += exp_negative ? -value : value;
+        p = q;
+    }
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (!is_field_end(p, end)) return parse_double_slow(start, end);
+
+    double value;
+    if (mantissa == 0) {
+        value = 0.0;
+    } else if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        value = (double)mantissa;
+        value = exponent < 0 ? value / exact_powers[-exponent] : value * exact_powers[exponent];
+    } else {
+        return parse_double_slow(start, end);
+    }
+    return negative ? -value : value;
+}
+
+// Same result as atoi for the labels this project uses
+static int parse_int(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    int value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (*p - '0');
+    }
+    return negative ? -value : value;
+}
+
+static const char* skip_field(const char* p, const char* end) {
+    while (!is_field_end(p, end)) p++;
+    return p;
+}
+
+static int count_chunk_rows(const char* p, const char* end) {
+    int n_rows = 0;
+    while (p < end) {
+        const char* line_end = next_line(p, end);
+        if (line_content_end(p, line_end) > p) n_rows++;
+        p = line_end + 1;
+    }
+    return n_rows;
+}
+
+// Parses the line [p, end), without its terminator, into row of dataset.
+// Returns 0 if the line has fewer fields than the header; the missing values
+// are then zero.
+int parse_csv_row(const char* p, const char* end, Dataset* dataset, int row) {
+    int f = 0;
+    for (; f < dataset->n_features; f++) {
+        dataset->features[(size_t)f * dataset->stride + row] = parse_double(p, end);
+        p = skip_field(p, end);
+        if (p == end) break;
+        p++;
+    }
+    if (f < dataset->n_features) {
+        // Ran out of fields before the label
+        for (f++; f < dataset->n_features; f++) {
+            dataset->features[(size_t)f * dataset->stride + row] = 0.0;
+        }
+        dataset->labels[row] = 0;
+        return 0;
+    }
+    dataset->labels[row] = parse_int(p, end);
+    return 1;
+}
+
+// Number of comma-separated columns of a header line
+int count_csv_columns(const char* p, const char* end) {
+    int n_columns = 1;
+    for (; p < end; p++) {
+        if (*p == ',') n_columns++;
+    }
+    return n_columns;
+}
+
+// Parses the rows of one chunk into the dataset columns. Blank lines are
+// skipped; a row with fewer fields than the header is recorded as bad.
+static void parse_chunk(LoadChunk* chunk, Dataset* dataset) {
+    const char* p = chunk->begin;
+    int row = chunk->first_row;
+
+    while (p < chunk->end) {
+        const char* line_end = next_line(p, chunk->end);
+        const char* end = line_content_end(p, line_end);
+        if (end > p) {
+            if (!parse_csv_row(p, end, dataset, row) && chunk->bad_row < 0) {
+                chunk->bad_row = row;
+            }
+            row++;
+        }
+        p = line_end + 1;
+    }
+}
+
+Dataset* load_dataset(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        fprintf(stderr, "Error: Cannot read file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+
+    // Private and writable, so that a mapped cache can be shuffled in place
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", filename);
+        return NULL;
+    }
+    if (is_dataset_cache(mapping, size)) {
+        return open_dataset_cache(mapping, size, filename);
+    }
+    
+    const char* text = mapping;
+    posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+    const char* text_end = text + size;
+
+    // Header: every column but the last is a feature
+    const char* body = next_line(text, text_end);
+    int n_features = count_csv_columns(text, line_content_end(text, body)) - 1;
+    if (body < text_end) body++;
+    if (n_features < 1) {
+        fprintf(stderr, "Error: %s needs at least one feature and a label column\n", filename);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    // Newline-aligned chunks: each one starts right after a line break
+    size_t body_size = text_end - body;
+    int n_chunks = (int)(body_size / LOAD_CHUNK_BYTES) + 1;
+    LoadChunk* chunks = malloc(n_chunks * sizeof(LoadChunk));
+    for (int c = 0; c < n_chunks; c++) {
+        const char* begin = body + body_size * c / n_chunks;
+        if (c > 0 && begin[-1] != '\n') {
+            begin = next_line(begin, text_end);
+            if (begin < text_end) begin++;
+        }
+        chunks[c].begin = begin;
+        chunks[c].bad_row = -1;
+        if (c > 0) chunks[c - 1].end = begin;
+    }
+    chunks[n_chunks - 1].end = text_end;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int c = 0; c < n_chunks; c++) {
+        chunks[c].n_rows = count_chunk_rows(chunks[c].begin, chunks[c].end);
+    }
+
+    long long n_samples = 0;
+    for (int c = 0; c < n_chunks; c++) {
+        chunks[c].first_row = (int)n_samples;
+        n_samples += chunks[c].n_rows;
+    }
+    if (n_samples > INT_MAX) {
+        fprintf(stderr, "Error: %s has more than %d rows\n", filename, INT_MAX);
+        free(chunks);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    Dataset* dataset = create_dataset((int)n_samples, n_features);
+    dataset->file_bytes = size;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int c = 0; c < n_chunks; c++) {
+        parse_chunk(&chunks[c], dataset);
+    }
+
+    int bad_row = -1;
+    for (int c = 0; c < n_chunks && bad_row < 0; c++) {
+        bad_row = chunks[c].bad_row;
+    }
+    free(chunks);
+    munmap(mapping, size);
+
+    if (bad_row >= 0) {
+        fprintf(stderr, "Error: data row %d of %s has fewer than %d columns\n",
+                bad_row + 1, filename, n_features + 1);
+        free_dataset(dataset);
+        return NULL;
+    }
+
+    printf("Loaded dataset: %d samples, %d features\n", dataset->n_samples, n_features);
+    return dataset;
+}
@@ -1,130 +1,158 @@
+#define _POSIX_C_SOURCE 200112L  // munmap
 #include "random_forest.h"
+#include <sys/mman.h>
 
-Dataset* load_dataset(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", filename);
-        return NULL;
-    }
-    
+// Allocates an empty dataset whose columns each start on a cache line
+Dataset* create_dataset(int n_samples, int n_features) {
     Dataset* dataset = malloc(sizeof(Dataset));
-    if (!dataset) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
-        fclose(file);
-        return NULL;
-    }
-    
-    // First pass: count lines and features
-    char line[4096];
-    int n_samples = 0;
-    int n_features = 0;
-    
-    // Skip header line and count features
-    if (fgets(line, sizeof(line), file)) {
-        char* token = strtok(line, ",");
-        while (token) {
-            n_features++;
-            token = strtok(NULL, ",");
-        }
-        n_features--; // Last column is label
-    }
-    
-    // Count data lines
-    while (fgets(line, sizeof(line), file)) {
-        n_samples++;
-    }
+    int per_line = CACHE_LINE / sizeof(double);
     
     dataset->n_samples = n_samples;
     dataset->n_features = n_features;
-    
-    // Allocate memory
-    dataset->features = malloc(n_samples * sizeof(double*));
+    dataset->stride = (n_samples + per_line - 1) / per_line * per_line;
+    dataset->features = malloc_aligned((size_t)n_features * dataset->stride * sizeof(double));
+    dataset->features32 = NULL;
+    dataset->features16 = NULL;
+    dataset->fixed_base = NULL;
+    dataset->fixed_step = NULL;
+    dataset->precision = PRECISION_DOUBLE;
     dataset->labels = malloc(n_samples * sizeof(int));
+    dataset->binned = NULL;
+    dataset->bins = NULL;
+    dataset->file_bytes = 0;
+    dataset->mapping = NULL;
+    dataset->mapping_bytes = 0;
     
-    for (int i = 0; i < n_samples; i++) {
-        dataset->features[i] = malloc(n_features * sizeof(double));
-    }
-    
-    // Second pass: read data
-    rewind(file);
-    fgets(line, sizeof(line), file); // Skip header
-    
-    int sample_idx = 0;
-    while (fgets(line, sizeof(line), file) && sample_idx < n_samples) {
-        char* token = strtok(line, ",");
-        int feature_idx = 0;
-        
-        // Read features
-        while (token && feature_idx < n_features) {
-            dataset->features[sample_idx][feature_idx] = atof(token);
-            token = strtok(NULL, ",");
-            feature_idx++;
-        }
-        
-        // Read label (last column)
-        if (token) {
-            dataset->labels[sample_idx] = atoi(token);
-        }
-        
-        sample_idx++;
-    }
-    
-    fclose(file);
-    printf("Loaded dataset: %d samples, %d features\n", n_samples, n_features);
     return dataset;
 }
 
 void free_dataset(Dataset* dataset) {
     if (!dataset) return;
     
-    if (dataset->features) {
-        for (int i = 0; i < dataset->n_samples; i++) {
-            free(dataset->features[i]);
-        }
+    if (dataset->mapping) {
+        munmap(dataset->mapping, dataset->mapping_bytes);
+    } else {
         free(dataset->features);
+        free(dataset->labels);
     }
-    
-    free(dataset->labels);
+    free(dataset->features32);
+    free(dataset->features16);
+    free(dataset->fixed_base);
+    free(dataset->fixed_step);
+    free(dataset->binned);
     free(dataset);
 }
 
-void shuffle_dataset(Dataset* dataset) {
-    for (int i = dataset->n_samples - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        
-        // Swap features
-        double* temp_features = dataset->features[i];
-        dataset->features[i] = dataset->features[j];
-        dataset->features[j] = temp_features;
-        
-        // Swap labels
-        int temp_label = dataset->labels[i];
-        dataset->labels[i] = dataset->labels[j];
-        dataset->labels[j] = temp_label;
+// Reorders every column by the same random permutation. The permutation is
+// drawn exactly like the former row swaps, then applied one column at a time.
+// Runs on double columns, before the storage precision is reduced.
+void shuffle_dataset(Dataset* dataset, RandomStream* rng) {
+    int n = dataset->n_samples;
+    int* order = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)random_below(rng, i + 1);
+        int temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
     }
-}
-
-Dataset* bootstrap_sample(Dataset* original, int sample_size) {
-    Dataset* sample = malloc(sizeof(Dataset));
-    sample->n_samples = sample_size;
-    sample->n_features = original->n_features;
     
-    sample->features = malloc(sample_size * sizeof(double*));
-    sample->labels = malloc(sample_size * sizeof(int));
+    double* column = malloc(n * sizeof(double));
+    for (int f = 0; f < dataset->n_features; f++) {
+        double* values = &dataset->features[(size_t)f * dataset->stride];
+        for (int i = 0; i < n; i++) {
+            column[i] = values[order[i]];
+        }
+        memcpy(values, column, n * sizeof(double));
+    }
+    free(column);
+    
+    if (dataset->binned) {
+        uint8_t* codes = malloc(n);
+        for (int f = 0; f < dataset->n_features; f++) {
+            uint8_t* binned = &dataset->binned[(size_t)f * dataset->stride];
+            for (int i = 0; i < n; i++) {
+                codes[i] = binned[order[i]];
+            }
+            memcpy(binned, codes, n);
+        }
+        free(codes);
+    }
     
+    int* labels = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        labels[i] = dataset->labels[order[i]];
+    }
+    memcpy(dataset->labels, labels, n * sizeof(int));
+    free(labels);
+    
+    free(order);
+}
+
+// Draws sample_size row ids with replacement. Trees train on this view of
+// the shared dataset, so a bootstrap costs one int per draw instead of a
+// copy of the features.
+int* bootstrap_sample(Dataset* original, int sample_size, RandomStream* rng) {
+    int* rows = malloc(sample_size * sizeof(int));
     for (int i = 0; i < sample_size; i++) {
-        sample->features[i] = malloc(original->n_features * sizeof(double));
-        
-        // Random sampling with replacement
-        int random_idx = rand() % original->n_samples;
-        
-        for (int j = 0; j < original->n_features; j++) {
-            sample->features[i][j] = original->features[random_idx][j];
+        rows[i] = (int)random_below(rng, original->n_samples);
+    }
+    return rows;
+}
+
+// Samples [first, first + n_samples) of dataset, sharing its columns. Only
+// the returned struct is freed by the caller.
+Dataset* create_dataset_view(Dataset* dataset, int first, int n_samples) {
+    Dataset* view = malloc(sizeof(Dataset));
+    *view = *dataset;
+    view->n_samples = n_samples;
+    if (dataset->features) view->features = dataset->features + first;
+    if (dataset->features32) view->features32 = dataset->features32 + first;
+    if (dataset->features16) view->features16 = dataset->features16 + first;
+    if (dataset->binned) view->binned = dataset->binned + first;
+    view->labels = dataset->labels + first;
+    view->file_bytes = 0;
+    view->mapping = NULL;
+    view->mapping_bytes = 0;
+    return view;
+}
+
+// Reads feature of the n samples listed in rows (the first n samples when
+// rows is NULL) into values, converting from the storage precision
+void gather_feature(Dataset* dataset, int feature, const int* rows, int n, double* values) {
+    size_t offset = (size_t)feature * dataset->stride;
+    
+    if (dataset->precision == PRECISION_FLOAT) {
+        const float* column = &dataset->features32[offset];
+        for (int i = 0; i < n; i++) {
+            values[i] = column[rows ? rows[i] : i];
+        }
+    } else if (dataset->precision == PRECISION_FIXED16) {
+        const uint16_t* column = &dataset->features16[offset];
+        double base = dataset->fixed_base[feature];
+        double step = dataset->fixed_step[feature];
+        for (int i = 0; i < n; i++) {
+            values[i] = base + column[rows ? rows[i] : i] * step;
+        }
+    } else {
+        const double* column = &dataset->features[offset];
+        if (!rows) {
+            memcpy(values, column, n * sizeof(double));
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            values[i] = column[rows[i]];
         }
-        sample->labels[i] = original->labels[random_idx];
     }
-    
-    return sample;
+}
+
+// Gathers sample i into a contiguous row, the layout predict_tree expects
+void get_sample(Dataset* dataset, int i, double* sample) {
+    for (int f = 0; f < dataset->n_features; f++) {
+        gather_feature(dataset, f, &i, 1, sample + f);
+    }
 }
 
 void print_dataset_info(Dataset* dataset) {
@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200112L  // munmap
+#include "random_forest.h"
+#include <sys/mman.h>
+
+// Binary dataset cache. The file is a header followed by 64-byte aligned
+// blocks, so a mapping of it can be used as a Dataset without parsing:
+//   features  n_features columns of stride doubles, column-major
+//   labels    n_samples int32
+//   bins      optional: n_bins per feature (int32), then max_bins edges
+//             (double) per feature
+// Values are stored in the byte order of the machine that wrote the file.
+
+#define DATASET_CACHE_VERSION 1
+#define CACHE_BLOCK_ALIGN 64
+
+static uint64_t align_block(uint64_t offset) {
+    return (offset + CACHE_BLOCK_ALIGN - 1) & ~(uint64_t)(CACHE_BLOCK_ALIGN - 1);
+}
+
+static int write_padding(FILE* file, uint64_t from, uint64_t to) {
+    static const char zeros[CACHE_BLOCK_ALIGN] = {0};
+    return to == from || fwrite(zeros, 1, to - from, file) == to - from;
+}
+
+int is_dataset_cache(const void* data, size_t size) {
+    return size >= sizeof(DatasetCacheHeader) &&
+           memcmp(data, DATASET_CACHE_MAGIC, sizeof(((DatasetCacheHeader*)0)->magic)) == 0;
+}
+
+// Writes dataset, and the edges of bins when given, in the cache format.
+// Returns 0 on success.
+int save_dataset_cache(Dataset* dataset, BinMapper* bins, const char* filename) {
+    DatasetCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DATASET_CACHE_VERSION;
+    header.n_features = dataset->n_features;
+    header.n_samples = dataset->n_samples;
+    header.stride = dataset->stride;
+    header.max_bins = bins ? bins->max_bins : 0;
+
+    uint64_t column_bytes = header.stride * sizeof(double);
+    header.features_offset = align_block(sizeof(header));
+    header.labels_offset = align_block(header.features_offset + header.n_features * column_bytes);
+    uint64_t end = header.labels_offset + header.n_samples * sizeof(int32_t);
+    if (bins) {
+        header.bins_offset = align_block(end);
+        end = header.bins_offset + align_block(header.n_features * sizeof(int32_t)) +
+              (uint64_t)header.n_features * header.max_bins * sizeof(double);
+    }
+    header.file_bytes = end;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create cache file %s\n", filename);
+        return -1;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             write_padding(file, sizeof(header), header.features_offset);
+
+    // Columns are written with their padding up to the stride
+    double* column = calloc(header.stride, sizeof(double));
+    for (int f = 0; ok && f < dataset->n_features; f++) {
+        memcpy(column, &dataset->features[(size_t)f * dataset->stride],
+               dataset->n_samples * sizeof(double));
+        ok = fwrite(column, sizeof(double), header.stride, file) == header.stride;
+    }
+    free(column);
+    ok = ok && write_padding(file, header.features_offset + header.n_features * column_bytes,
+                             header.labels_offset);
+
+    // int is 32 bits on every platform this project builds on
+    ok = ok && fwrite(dataset->labels, sizeof(int32_t), dataset->n_samples, file) ==
+               (size_t)dataset->n_samples;
+
+    if (ok && bins) {
+        uint64_t counts_end = header.bins_offset + header.n_features * sizeof(int32_t);
+        ok = write_padding(file, header.labels_offset + header.n_samples * sizeof(int32_t),
+                           header.bins_offset) &&
+             fwrite(bins->n_bins, sizeof(int32_t), bins->n_features, file) ==
+                 (size_t)bins->n_features &&
+             write_padding(file, counts_end, align_block(counts_end));
+        // Edges past a feature's bin count are written as zeros
+        double* edges = calloc(bins->max_bins, sizeof(double));
+        for (int f = 0; ok && f < bins->n_features; f++) {
+            memcpy(edges, bins->edges[f], bins->n_bins[f] * sizeof(double));
+            ok = fwrite(edges, sizeof(double), bins->max_bins, file) == (size_t)bins->max_bins;
+        }
+        free(edges);
+    }
+
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write cache file %s\n", filename);
+        remove(filename);
+        return -1;
+    }
+
+    printf("Wrote dataset cache %s (%.1f MB%s)\n", filename,
+           header.file_bytes / (1024.0 * 1024.0), bins ? ", with bin edges" : "");
+    return 0;
+}
+
+// Checks that the blocks described by header lie inside a file of size bytes
+int check_cache_header(const DatasetCacheHeader* header, size_t size) {
+    uint64_t column_bytes = header->stride * sizeof(double);
+    int valid = header->version == DATASET_CACHE_VERSION && header->file_bytes == size &&
+                header->n_features > 0 && header->n_samples <= INT32_MAX &&
+                header->stride >= header->n_samples && header->stride <= INT32_MAX &&
+                header->max_bins <= MAX_BINS &&
+                header->features_offset % CACHE_BLOCK_ALIGN == 0 &&
+                header->features_offset + header->n_features * column_bytes <= header->labels_offset &&
+                header->labels_offset + header->n_samples * sizeof(int32_t) <= size;
+    if (valid && header->max_bins > 0) {
+        valid = header->bins_offset % CACHE_BLOCK_ALIGN == 0 &&
+                header->bins_offset >= header->labels_offset + header->n_samples * sizeof(int32_t) &&
+                header->bins_offset + align_block(header->n_features * sizeof(int32_t)) +
+                    (uint64_t)header->n_features * header->max_bins * sizeof(double) <= size;
+    }
+    return valid;
+}
+
+// Wraps a private read-write mapping of a cache file as a Dataset. The
+// columns and labels stay in the mapping, which the dataset then owns;
+// pages are only copied when the dataset is modified (e.g. shuffled).
+// Cached bin edges become dataset->bins, owned by the caller.
+Dataset* open_dataset_cache(void* mapping, size_t size, const char* filename) {
+    DatasetCacheHeader header;
+    memcpy(&header, mapping, sizeof(header));
+
+    int valid = check_cache_header(&header, size);
+    if (valid && header.max_bins > 0) {
+        for (uint32_t f = 0; valid && f < header.n_features; f++) {
+            int32_t n_bins = ((int32_t*)((char*)mapping + header.bins_offset))[f];
+            valid = n_bins >= 1 && n_bins <= (int32_t)header.max_bins;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "Error: %s is not a valid version %d dataset cache\n", filename,
+                DATASET_CACHE_VERSION);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    char* base = mapping;
+    Dataset* dataset = malloc(sizeof(Dataset));
+    dataset->n_samples = (int)header.n_samples;
+    dataset->n_features = (int)header.n_features;
+    dataset->stride = (int)header.stride;
+    dataset->features = (double*)(base + header.features_offset);
+    dataset->features32 = NULL;
+    dataset->features16 = NULL;
+    dataset->fixed_base = NULL;
+    dataset->fixed_step = NULL;
+    dataset->precision = PRECISION_DOUBLE;
+    dataset->labels = (int*)(base + header.labels_offset);
+    dataset->binned = NULL;
+    dataset->bins = NULL;
+    dataset->file_bytes = size;
+    dataset->mapping = mapping;
+    dataset->mapping_bytes = size;
+
+    if (header.max_bins > 0) {
+        int32_t* n_bins = (int32_t*)(base + header.bins_offset);
+        double* edges = (double*)(base + header.bins_offset +
+                                  align_block(header.n_features * sizeof(int32_t)));
+        BinMapper* bins = malloc(sizeof(BinMapper));
+        bins->n_features = dataset->n_features;
+        bins->max_bins = header.max_bins;
+        bins->n_bins = malloc(bins->n_features * sizeof(int));
+        bins->edges = malloc(bins->n_features * sizeof(double*));
+        memcpy(bins->n_bins, n_bins, bins->n_features * sizeof(int));
+        for (int f = 0; f < bins->n_features; f++) {
+            bins->edges[f] = malloc(bins->max_bins * sizeof(double));
+            memcpy(bins->edges[f], &edges[(size_t)f * bins->max_bins],
+                   bins->max_bins * sizeof(double));
+        }
+        dataset->bins = bins;
+    }
+
+    printf("Mapped dataset cache: %d samples, %d features%s\n", dataset->n_samples,
+           dataset->n_features, dataset->bins ? ", bin edges included" : "");
+    return dataset;
+}
@@ -0,0 +1,269 @@
+#include "random_forest.h"
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Batched inference. Samples are scored in blocks of PREDICT_BLOCK_SAMPLES
+// rows, tree-major: each tree walks every sample of the block before the
+// next tree is loaded, so its nodes stay in L1/L2 across the block instead
+// of being evicted by the rest of the forest between two walks. Votes go
+// into a block x class matrix owned by the calling thread.
+
+// Records what inference needs once every tree is frozen: the sample width
+// and the number of vote slots
+void finalize_forest(RandomForest* rf, int n_features) {
+    int max_class = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        if (tree->flat) {
+            for (int i = 0; i < tree->n_flat; i++) {
+                if (!tree->flat[i].skip && tree->flat[i].value > max_class) {
+                    max_class = tree->flat[i].value;
+                }
+            }
+        } else {
+            for (int i = 0; i < tree->n_nodes; i++) {
+                if (tree->nodes[i].is_leaf && tree->nodes[i].prediction > max_class) {
+                    max_class = tree->nodes[i].prediction;
+                }
+            }
+        }
+    }
+    rf->n_features = n_features;
+    rf->n_classes = max_class + 1;
+}
+
+// Scores the n <= PREDICT_BLOCK_SAMPLES rows of X (row-major, rf->n_features
+// columns) on the calling thread. votes holds n * rf->n_classes ints. Ties
+// go to the lowest class, as in get_majority_class.
+void predict_forest_block(RandomForest* rf, double* X, int n, int* votes, int* out) {
+    int n_classes = rf->n_classes;
+    memset(votes, 0, (size_t)n * n_classes * sizeof(int));
+
+    if (rf->engine == ENGINE_QUICKSCORER && rf->quickscorer) {
+        quickscorer_votes(rf->quickscorer, X, n, rf->n_features, votes, n_classes);
+    } else if (rf->engine == ENGINE_PERFECT && rf->perfect) {
+        perfect_forest_votes(rf->perfect, X, n, rf->n_features, votes, n_classes);
+    } else {
+        for (int t = 0; t < rf->n_trees; t++) {
+            DecisionTree* tree = &rf->trees[t];
+            for (int s = 0; s < n; s++) {
+                votes[s * n_classes + predict_tree(tree, &X[(size_t)s * rf->n_features])]++;
+            }
+        }
+    }
+
+    for (int s = 0; s < n; s++) {
+        int* counts = &votes[s * n_classes];
+        int best = 0;
+        for (int c = 1; c < n_classes; c++) {
+            if (counts[c] > counts[best]) best = c;
+        }
+        out[s] = best;
+    }
+}
+
+// Majority vote of the forest for the n rows of X (row-major, rf->n_features
+// columns) into out. Blocks are spread over the threads; there is no nested
+// region, and a single block stays on the calling thread.
+void predict_random_forest_batch(RandomForest* rf, double* X, int n, int* out) {
+    int n_blocks = (n + PREDICT_BLOCK_SAMPLES - 1) / PREDICT_BLOCK_SAMPLES;
+
+    #ifdef _OPENMP
+    #pragma omp parallel if(n_blocks > 1)
+    #endif
+    {
+        int* votes = malloc((size_t)PREDICT_BLOCK_SAMPLES * rf->n_classes * sizeof(int));
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+        #endif
+        for (int b = 0; b < n_blocks; b++) {
+            int first = b * PREDICT_BLOCK_SAMPLES;
+            int count = n - first < PREDICT_BLOCK_SAMPLES ? n - first : PREDICT_BLOCK_SAMPLES;
+            predict_forest_block(rf, &X[(size_t)first * rf->n_features], count, votes, &out[first]);
+        }
+
+        free(votes);
+    }
+}
+
+int parse_engine(const char* name) {
+    if (strcmp(name, "quickscorer") == 0) return ENGINE_QUICKSCORER;
+    if (strcmp(name, "perfect") == 0) return ENGINE_PERFECT;
+    if (strcmp(name, "tree") == 0) return ENGINE_TREE;
+    return -1;
+}
+
+const char* engine_name(int engine) {
+    if (engine == ENGINE_QUICKSCORER) return "quickscorer";
+    if (engine == ENGINE_PERFECT) return "perfect";
+    return "tree";
+}
+
+// Selects the engine of a trained, finalized forest, compiling what it needs
+void set_inference_engine(RandomForest* rf, int engine) {
+    if (engine == ENGINE_QUICKSCORER && !rf->quickscorer) {
+        rf->quickscorer = compile_quickscorer(rf);
+    }
+    if (engine == ENGINE_PERFECT && !rf->perfect) {
+        rf->perfect = compile_perfect_forest(rf);
+    }
+    rf->engine = engine;
+}
+
+// Scores test_data with the tree walker and with rf's engine: throughput of
+// both, and the predictions where they differ (there should be none)
+void print_engine_report(RandomForest* rf, Dataset* test_data) {
+    int n = test_data->n_samples;
+    double* X = malloc((size_t)n * test_data->n_features * sizeof(double));
+    int* expected = malloc(n * sizeof(int));
+    int* actual = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        get_sample(test_data, i, &X[(size_t)i * test_data->n_features]);
+    }
+
+    int engine = rf->engine;
+    double seconds[2];
+    struct timeval start, end;
+    for (int pass = 0; pass < 2; pass++) {
+        rf->engine = pass == 0 ? ENGINE_TREE : engine;
+        gettimeofday(&start, NULL);
+        predict_random_forest_batch(rf, X, n, pass == 0 ? expected : actual);
+        gettimeofday(&end, NULL);
+        seconds[pass] = get_time_diff(start, end);
+    }
+    rf->engine = engine;
+
+    int differing = 0;
+    for (int i = 0; i < n; i++) {
+        differing += expected[i] != actual[i];
+    }
+
+    printf("Inference engine check on %d test samples:\n", n);
+    printf("  tree: %.0f rows/s\n", seconds[0] > 0.0 ? n / seconds[0] : 0.0);
+    printf("  %s: %.0f rows/s\n", engine_name(engine), seconds[1] > 0.0 ? n / seconds[1] : 0.0);
+    printf("  Different predictions: %d/%d\n", differing, n);
+
+    free(X);
+    free(expected);
+    free(actual);
+}
+
+// Single-sample voting that stops early, for latency-bound scoring. Trees
+// vote in order until the leader can no longer lose: with r trees left,
+// every other class would still trail it after taking all r votes (a class
+// below the leader wins a tie, so it must stay strictly behind). The
+// answer is then the full forest's. A confidence below 1 also stops once
+// the margin m over the strongest challenger satisfies
+// exp(-m^2 / 2r) <= 1 - confidence, the Hoeffding bound for the remaining
+// votes erasing m without drift; that answer can differ from the full
+// forest's. votes is caller-owned scratch of rf->n_classes ints, so the
+// path never allocates; it is cleared here. fractions, if not NULL, gets
+// the vote share of each class among the trees that voted, and
+// n_evaluated, if not NULL, how many did.
+int predict_early_exit(RandomForest* rf, double* sample, double confidence, int* votes,
+                       double* fractions, int* n_evaluated) {
+    int n_classes = rf->n_classes;
+    memset(votes, 0, n_classes * sizeof(int));
+    double min_margin_sq = confidence < 1.0 ? 2.0 * log(1.0 / (1.0 - confidence)) : 0.0;
+
+    int leader = 0;
+    int evaluated = 0;
+    while (evaluated < rf->n_trees) {
+        int c = predict_tree(&rf->trees[evaluated++], sample);
+        votes[c]++;
+        if (c != leader && (votes[c] > votes[leader] || (votes[c] == votes[leader] && c < leader))) {
+            leader = c;
+        }
+
+        // The margin is at most the leader's votes; find the challenger only
+        // when that could be enough to stop
+        int remaining = rf->n_trees - evaluated;
+        int lead = votes[leader];
+        if (lead < remaining && (min_margin_sq == 0.0 || (double)lead * lead < min_margin_sq * remaining)) {
+            continue;
+        }
+
+        int challenger = 0;
+        for (int k = 0; k < n_classes; k++) {
+            int need = votes[k] + (k < leader);
+            if (k != leader && need > challenger) challenger = need;
+        }
+        int margin = lead - challenger;
+        if (margin >= remaining) break;
+        if (min_margin_sq > 0.0 && margin > 0 &&
+            (double)margin * margin >= min_margin_sq * remaining) {
+            break;
+        }
+    }
+
+    if (fractions) {
+        for (int k = 0; k < n_classes; k++) {
+            fractions[k] = (double)votes[k] / evaluated;
+        }
+    }
+    if (n_evaluated) *n_evaluated = evaluated;
+    return leader;
+}
+
+// Scores test_data one sample at a time, with the full vote and with
+// predict_early_exit: latency of both, trees evaluated on average and the
+// predictions where they differ (none when confidence is 1)
+void print_early_exit_report(RandomForest* rf, Dataset* test_data, double confidence) {
+    int n = test_data->n_samples;
+    double* X = malloc((size_t)n * test_data->n_features * sizeof(double));
+    int* full = malloc(n * sizeof(int));
+    int* early = malloc(n * sizeof(int));
+    int* votes = malloc(rf->n_classes * sizeof(int));
+    double* fractions = malloc(rf->n_classes * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        get_sample(test_data, i, &X[(size_t)i * test_data->n_features]);
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < n; i++) {
+        full[i] = predict_random_forest(rf, &X[(size_t)i * test_data->n_features]);
+    }
+    gettimeofday(&end, NULL);
+    double full_seconds = get_time_diff(start, end);
+
+    long trees_evaluated = 0;
+    double leader_share = 0.0;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < n; i++) {
+        int evaluated;
+        early[i] = predict_early_exit(rf, &X[(size_t)i * test_data->n_features], confidence,
+                                      votes, fractions, &evaluated);
+        trees_evaluated += evaluated;
+        leader_share += fractions[early[i]];
+    }
+    gettimeofday(&end, NULL);
+    double early_seconds = get_time_diff(start, end);
+
+    int differing = 0, full_correct = 0, early_correct = 0;
+    for (int i = 0; i < n; i++) {
+        differing += full[i] != early[i];
+        full_correct += full[i] == test_data->labels[i];
+        early_correct += early[i] == test_data->labels[i];
+    }
+
+    printf("Early-exit voting on %d test samples, one at a time (confidence %g):\n", n, confidence);
+    printf("  Trees evaluated: %.1f of %d on average\n", n > 0 ? (double)trees_evaluated / n : 0.0,
+           rf->n_trees);
+    printf("  Vote share of the predicted class: %.1f%% on average\n",
+           n > 0 ? 100.0 * leader_share / n : 0.0);
+    printf("  Latency: full vote %.2f us, early exit %.2f us per sample\n",
+           n > 0 ? 1e6 * full_seconds / n : 0.0, n > 0 ? 1e6 * early_seconds / n : 0.0);
+    printf("  Accuracy: full vote %.2f%%, early exit %.2f%%\n",
+           n > 0 ? 100.0 * full_correct / n : 0.0, n > 0 ? 100.0 * early_correct / n : 0.0);
+    printf("  Different predictions: %d/%d\n", differing, n);
+
+    free(X);
+    free(full);
+    free(early);
+    free(votes);
+    free(fractions);
+}
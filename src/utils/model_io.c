@@ -0,0 +1,157 @@
+#include "random_forest.h"
+
+// Trained forest files. A header is followed, for every tree, by its node
+// count and its nodes in training layout; child ids always point past their
+// parent, which load_random_forest checks. Values are stored in the byte
+// order of the machine that wrote the file.
+
+#define MODEL_MAGIC "ARFMODL"
+#define MODEL_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_trees;
+    uint32_t n_features;
+    uint32_t n_classes;
+    uint32_t max_depth;
+    uint32_t reserved;
+    uint64_t seed;
+} ModelHeader;
+
+typedef struct {
+    double threshold;
+    int32_t feature_index;
+    int32_t left_child;
+    int32_t right_child;
+    int32_t prediction;
+    int32_t is_leaf;
+    int32_t reserved;
+} ModelNode;
+
+// Writes the trees of rf to filename. Returns 0 on success.
+int save_random_forest(RandomForest* rf, const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create model file %s\n", filename);
+        return -1;
+    }
+
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.n_trees = rf->n_trees;
+    header.n_features = rf->n_features;
+    header.n_classes = rf->n_classes;
+    header.max_depth = rf->max_depth;
+    header.seed = rf->seed;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    long total_nodes = 0;
+    for (int t = 0; ok && t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        uint32_t n_nodes = tree->n_nodes;
+        ok = fwrite(&n_nodes, sizeof(n_nodes), 1, file) == 1;
+        for (int i = 0; ok && i < tree->n_nodes; i++) {
+            TreeNode* node = &tree->nodes[i];
+            ModelNode out;
+            memset(&out, 0, sizeof(out));
+            out.threshold = node->threshold;
+            out.feature_index = node->feature_index;
+            out.left_child = node->left_child;
+            out.right_child = node->right_child;
+            out.prediction = node->prediction;
+            out.is_leaf = node->is_leaf;
+            ok = fwrite(&out, sizeof(out), 1, file) == 1;
+        }
+        total_nodes += tree->n_nodes;
+    }
+
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write model file %s\n", filename);
+        remove(filename);
+        return -1;
+    }
+
+    printf("Saved model %s: %d trees, %ld nodes\n", filename, rf->n_trees, total_nodes);
+    return 0;
+}
+
+// Checks the links of one tree: children past their parent and inside the
+// tree, features inside the sample, classes inside the vote slots
+static int valid_tree(DecisionTree* tree, const ModelHeader* header) {
+    for (int i = 0; i < tree->n_nodes; i++) {
+        TreeNode* node = &tree->nodes[i];
+        if (node->is_leaf) {
+            if (node->prediction < 0 || (uint32_t)node->prediction >= header->n_classes) return 0;
+        } else if (node->feature_index < 0 || (uint32_t)node->feature_index >= header->n_features ||
+                   node->left_child <= i || node->left_child >= tree->n_nodes ||
+                   node->right_child <= i || node->right_child >= tree->n_nodes) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Reads a forest written by save_random_forest, with its trees frozen and
+// ready for inference. Returns NULL on error.
+RandomForest* load_random_forest(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open model file %s\n", filename);
+        return NULL;
+    }
+
+    ModelHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MODEL_VERSION || header.n_trees == 0 || header.n_trees > INT32_MAX ||
+        header.n_features == 0 || header.n_classes == 0) {
+        fprintf(stderr, "Error: %s is not a version %d model file\n", filename, MODEL_VERSION);
+        fclose(file);
+        return NULL;
+    }
+
+    RandomForest* rf = create_random_forest((int)header.n_trees, (int)header.max_depth,
+                                            MIN_SAMPLES_SPLIT, 0);
+    rf->seed = header.seed;
+
+    int ok = 1;
+    for (int t = 0; ok && t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        uint32_t n_nodes;
+        ok = fread(&n_nodes, sizeof(n_nodes), 1, file) == 1 && n_nodes <= INT32_MAX;
+        if (!ok) break;
+
+        tree->capacity = n_nodes > 0 ? (int)n_nodes : 1;
+        tree->nodes = malloc(tree->capacity * sizeof(TreeNode));
+        tree->n_nodes = (int)n_nodes;
+        for (int i = 0; ok && i < tree->n_nodes; i++) {
+            ModelNode in;
+            ok = fread(&in, sizeof(in), 1, file) == 1;
+            tree->nodes[i].threshold = in.threshold;
+            tree->nodes[i].feature_index = in.feature_index;
+            tree->nodes[i].left_child = in.left_child;
+            tree->nodes[i].right_child = in.right_child;
+            tree->nodes[i].prediction = in.prediction;
+            tree->nodes[i].is_leaf = in.is_leaf;
+        }
+        ok = ok && valid_tree(tree, &header);
+        if (ok) freeze_tree(tree);
+    }
+    ok = ok && fgetc(file) == EOF;
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Error: Model file %s is truncated or corrupt\n", filename);
+        free_random_forest(rf);
+        return NULL;
+    }
+
+    finalize_forest(rf, (int)header.n_features);
+    // Leaves may not use every class the forest was trained on
+    if (rf->n_classes < (int)header.n_classes) rf->n_classes = (int)header.n_classes;
+    return rf;
+}
@@ -0,0 +1,249 @@
+#include "random_forest.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Perfect-tree inference. Padding every tree to a complete binary tree of
+// its own depth d removes the leaf test from the walk: a sample takes
+// exactly d steps of idx = 2 * idx + 1 + (goes right), with no branch on
+// the data, and the step count is the same for every sample. The SIMD
+// walkers move a vector of samples through the same tree in lockstep with
+// gathers. "Goes right" is !(x <= threshold) as in predict_tree, so a NaN
+// goes right and every walker returns the tree walker's leaf.
+//
+// Padding costs 2^d nodes per tree whatever the tree's size, which is why
+// it stops at PERFECT_MAX_DEPTH; a deeper tree keeps predict_tree.
+
+static void walk_scalar(const double* thresholds, const int32_t* features, int depth,
+                        const double* X, int n, int stride, int32_t* leaf) {
+    size_t first_leaf = ((size_t)1 << depth) - 1;
+    for (int s = 0; s < n; s++) {
+        const double* row = &X[(size_t)s * stride];
+        size_t idx = 0;
+        for (int d = 0; d < depth; d++) {
+            idx = 2 * idx + 1 + !(row[features[idx]] <= thresholds[idx]);
+        }
+        leaf[s] = (int32_t)(idx - first_leaf);
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// AVX2: 4 samples per vector, two vectors in flight so that one's gathers
+// overlap the other's
+
+__attribute__((target("avx2")))
+static void walk_avx2(const double* thresholds, const int32_t* features, int depth,
+                      const double* X, int n, int stride, int32_t* leaf) {
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i first_leaf = _mm256_set1_epi64x(((long long)1 << depth) - 1);
+    const __m256i rows = _mm256_setr_epi64x(0, stride, 2LL * stride, 3LL * stride);
+    int s = 0;
+
+    for (; s + 8 <= n; s += 8) {
+        const double* a_base = &X[(size_t)s * stride];
+        const double* b_base = &X[(size_t)(s + 4) * stride];
+        __m256i a = _mm256_setzero_si256();
+        __m256i b = _mm256_setzero_si256();
+        for (int d = 0; d < depth; d++) {
+            __m256d a_threshold = _mm256_i64gather_pd(thresholds, a, 8);
+            __m256d b_threshold = _mm256_i64gather_pd(thresholds, b, 8);
+            __m256i a_column = _mm256_add_epi64(rows, _mm256_cvtepi32_epi64(_mm256_i64gather_epi32(features, a, 4)));
+            __m256i b_column = _mm256_add_epi64(rows, _mm256_cvtepi32_epi64(_mm256_i64gather_epi32(features, b, 4)));
+            __m256d a_value = _mm256_i64gather_pd(a_base, a_column, 8);
+            __m256d b_value = _mm256_i64gather_pd(b_base, b_column, 8);
+            // The compare sets all bits (-1) in the lanes that go right
+            __m256i a_right = _mm256_castpd_si256(_mm256_cmp_pd(a_value, a_threshold, _CMP_NLE_UQ));
+            __m256i b_right = _mm256_castpd_si256(_mm256_cmp_pd(b_value, b_threshold, _CMP_NLE_UQ));
+            a = _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(a, a), one), a_right);
+            b = _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(b, b), one), b_right);
+        }
+        // Low halves of the 64-bit lanes
+        const __m256i low = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        a = _mm256_permutevar8x32_epi32(_mm256_sub_epi64(a, first_leaf), low);
+        b = _mm256_permutevar8x32_epi32(_mm256_sub_epi64(b, first_leaf), low);
+        _mm_storeu_si128((__m128i*)&leaf[s], _mm256_castsi256_si128(a));
+        _mm_storeu_si128((__m128i*)&leaf[s + 4], _mm256_castsi256_si128(b));
+    }
+
+    walk_scalar(thresholds, features, depth, &X[(size_t)s * stride], n - s, stride, &leaf[s]);
+}
+
+// AVX-512: 8 samples per vector, two vectors in flight
+
+__attribute__((target("avx512f")))
+static void walk_avx512(const double* thresholds, const int32_t* features, int depth,
+                        const double* X, int n, int stride, int32_t* leaf) {
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i first_leaf = _mm512_set1_epi64(((long long)1 << depth) - 1);
+    const __m512i rows = _mm512_setr_epi64(0, stride, 2LL * stride, 3LL * stride, 4LL * stride,
+                                           5LL * stride, 6LL * stride, 7LL * stride);
+    int s = 0;
+
+    for (; s + 16 <= n; s += 16) {
+        const double* a_base = &X[(size_t)s * stride];
+        const double* b_base = &X[(size_t)(s + 8) * stride];
+        __m512i a = _mm512_setzero_si512();
+        __m512i b = _mm512_setzero_si512();
+        for (int d = 0; d < depth; d++) {
+            __m512d a_threshold = _mm512_i64gather_pd(a, thresholds, 8);
+            __m512d b_threshold = _mm512_i64gather_pd(b, thresholds, 8);
+            __m512i a_column = _mm512_add_epi64(rows, _mm512_cvtepi32_epi64(_mm512_i64gather_epi32(a, features, 4)));
+            __m512i b_column = _mm512_add_epi64(rows, _mm512_cvtepi32_epi64(_mm512_i64gather_epi32(b, features, 4)));
+            __m512d a_value = _mm512_i64gather_pd(a_column, a_base, 8);
+            __m512d b_value = _mm512_i64gather_pd(b_column, b_base, 8);
+            __mmask8 a_right = _mm512_cmp_pd_mask(a_value, a_threshold, _CMP_NLE_UQ);
+            __mmask8 b_right = _mm512_cmp_pd_mask(b_value, b_threshold, _CMP_NLE_UQ);
+            a = _mm512_add_epi64(_mm512_add_epi64(a, a), one);
+            b = _mm512_add_epi64(_mm512_add_epi64(b, b), one);
+            a = _mm512_mask_add_epi64(a, a_right, a, one);
+            b = _mm512_mask_add_epi64(b, b_right, b, one);
+        }
+        _mm256_storeu_si256((__m256i*)&leaf[s], _mm512_cvtepi64_epi32(_mm512_sub_epi64(a, first_leaf)));
+        _mm256_storeu_si256((__m256i*)&leaf[s + 8], _mm512_cvtepi64_epi32(_mm512_sub_epi64(b, first_leaf)));
+    }
+
+    walk_scalar(thresholds, features, depth, &X[(size_t)s * stride], n - s, stride, &leaf[s]);
+}
+
+#endif // HAVE_X86_KERNELS
+
+// Widest walker the CPU supports
+static void select_walk(PerfectForest* pf) {
+    pf->kernel = "scalar";
+    pf->walk = walk_scalar;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        pf->kernel = "avx2";
+        pf->walk = walk_avx2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        pf->kernel = "avx512";
+        pf->walk = walk_avx512;
+    }
+#endif
+}
+
+static int subtree_depth(DecisionTree* tree, int node_idx) {
+    TreeNode* node = &tree->nodes[node_idx];
+    if (node->is_leaf) return 0;
+    int left = subtree_depth(tree, node->left_child);
+    int right = subtree_depth(tree, node->right_child);
+    return 1 + (left > right ? left : right);
+}
+
+// Writes the subtree of node_idx at heap position heap, level steps below
+// the root. A leaf above the bottom becomes a split whose both sides
+// continue with the same leaf.
+static void pad_subtree(PerfectForest* pf, int t, DecisionTree* tree, int node_idx,
+                        size_t heap, int level) {
+    int depth = pf->depth[t];
+    TreeNode* node = &tree->nodes[node_idx];
+    if (level == depth) {
+        size_t first_leaf = ((size_t)1 << depth) - 1;
+        pf->leaf_class[pf->leaf_offset[t] + heap - first_leaf] = node->prediction;
+        return;
+    }
+
+    size_t slot = pf->node_offset[t] + heap;
+    if (node->is_leaf) {
+        pf->thresholds[slot] = 0.0;
+        pf->features[slot] = 0;
+        pad_subtree(pf, t, tree, node_idx, 2 * heap + 1, level + 1);
+        pad_subtree(pf, t, tree, node_idx, 2 * heap + 2, level + 1);
+    } else {
+        pf->thresholds[slot] = node->threshold;
+        pf->features[slot] = node->feature_index;
+        pad_subtree(pf, t, tree, node->left_child, 2 * heap + 1, level + 1);
+        pad_subtree(pf, t, tree, node->right_child, 2 * heap + 2, level + 1);
+    }
+}
+
+PerfectForest* compile_perfect_forest(RandomForest* rf) {
+    PerfectForest* pf = malloc(sizeof(PerfectForest));
+    pf->n_trees = rf->n_trees;
+    pf->trees = rf->trees;
+    pf->depth = malloc(rf->n_trees * sizeof(int));
+    pf->node_offset = malloc(rf->n_trees * sizeof(size_t));
+    pf->leaf_offset = malloc(rf->n_trees * sizeof(size_t));
+    select_walk(pf);
+
+    size_t n_nodes = 0, n_leaves = 0;
+    int n_padded = 0, deepest = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        int depth = tree->n_nodes > 0 ? subtree_depth(tree, 0) : 0;
+        if (depth > PERFECT_MAX_DEPTH) {
+            pf->depth[t] = -1;
+            continue;
+        }
+        pf->depth[t] = depth;
+        pf->node_offset[t] = n_nodes;
+        pf->leaf_offset[t] = n_leaves;
+        n_nodes += ((size_t)1 << depth) - 1;
+        n_leaves += (size_t)1 << depth;
+        n_padded++;
+        if (depth > deepest) deepest = depth;
+    }
+
+    pf->thresholds = malloc((n_nodes > 0 ? n_nodes : 1) * sizeof(double));
+    pf->features = malloc((n_nodes > 0 ? n_nodes : 1) * sizeof(int32_t));
+    pf->leaf_class = malloc((n_leaves > 0 ? n_leaves : 1) * sizeof(int32_t));
+    for (int t = 0; t < rf->n_trees; t++) {
+        if (pf->depth[t] < 0) continue;
+        if (rf->trees[t].n_nodes == 0) {
+            pf->leaf_class[pf->leaf_offset[t]] = 0;  // predict_tree's answer for an empty tree
+        } else {
+            pad_subtree(pf, t, &rf->trees[t], 0, 0, 0);
+        }
+    }
+
+    printf("Perfect trees: %d of %d trees padded, depth <= %d, %.1f KB, %s walk\n",
+           n_padded, rf->n_trees, deepest,
+           (n_nodes * (sizeof(double) + sizeof(int32_t)) + n_leaves * sizeof(int32_t)) / 1024.0,
+           pf->kernel);
+    return pf;
+}
+
+void free_perfect_forest(PerfectForest* pf) {
+    if (!pf) return;
+    free(pf->depth);
+    free(pf->node_offset);
+    free(pf->leaf_offset);
+    free(pf->thresholds);
+    free(pf->features);
+    free(pf->leaf_class);
+    free(pf);
+}
+
+// Adds the vote of every tree for the n rows of X (row-major, stride
+// columns) to votes[i * n_classes + class], tree-major like
+// predict_forest_block
+void perfect_forest_votes(PerfectForest* pf, double* X, int n, int stride, int* votes, int n_classes) {
+    int32_t leaf[PREDICT_BLOCK_SAMPLES];
+
+    for (int first = 0; first < n; first += PREDICT_BLOCK_SAMPLES) {
+        int count = n - first < PREDICT_BLOCK_SAMPLES ? n - first : PREDICT_BLOCK_SAMPLES;
+        double* rows = &X[(size_t)first * stride];
+        int* block_votes = &votes[(size_t)first * n_classes];
+
+        for (int t = 0; t < pf->n_trees; t++) {
+            if (pf->depth[t] < 0) {
+                for (int s = 0; s < count; s++) {
+                    block_votes[s * n_classes + predict_tree(&pf->trees[t], &rows[(size_t)s * stride])]++;
+                }
+                continue;
+            }
+
+            pf->walk(&pf->thresholds[pf->node_offset[t]], &pf->features[pf->node_offset[t]],
+                     pf->depth[t], rows, count, stride, leaf);
+            const int32_t* leaf_class = &pf->leaf_class[pf->leaf_offset[t]];
+            for (int s = 0; s < count; s++) {
+                block_votes[s * n_classes + leaf_class[leaf[s]]]++;
+            }
+        }
+    }
+}
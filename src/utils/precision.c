@@ -0,0 +1,196 @@
+#include "random_forest.h"
+#include <float.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Reduced feature storage. Both conversions are monotonic, so the sorted
+// order of every feature is kept and a split can only change where two
+// distinct double values become equal. set_dataset_precision counts those
+// merges, and print_precision_report compares a forest against one trained
+// on the double columns.
+
+#define FIXED16_MAX_CODE 65535
+
+int parse_precision(const char* name) {
+    if (strcmp(name, "float") == 0) return PRECISION_FLOAT;
+    if (strcmp(name, "fixed16") == 0) return PRECISION_FIXED16;
+    if (strcmp(name, "double") == 0) return PRECISION_DOUBLE;
+    return -1;
+}
+
+const char* precision_name(int precision) {
+    if (precision == PRECISION_FLOAT) return "float";
+    if (precision == PRECISION_FIXED16) return "fixed16";
+    return "double";
+}
+
+static size_t precision_bytes(int precision) {
+    if (precision == PRECISION_FLOAT) return sizeof(float);
+    if (precision == PRECISION_FIXED16) return sizeof(uint16_t);
+    return sizeof(double);
+}
+
+static uint16_t fixed16_code(double value, double base, double step) {
+    if (step == 0.0) return 0;
+    double code = floor((value - base) / step + 0.5);
+    return code > FIXED16_MAX_CODE ? FIXED16_MAX_CODE : (uint16_t)code;
+}
+
+// Converts the double columns to the given precision and frees them. Runs
+// after binning and shuffling, which only handle double columns.
+void set_dataset_precision(Dataset* dataset, int precision) {
+    if (precision == PRECISION_DOUBLE || dataset->precision != PRECISION_DOUBLE) return;
+
+    int n = dataset->n_samples;
+    size_t n_values = (size_t)dataset->n_features * dataset->stride;
+    if (precision == PRECISION_FLOAT) {
+        dataset->features32 = malloc_aligned(n_values * sizeof(float));
+    } else {
+        dataset->features16 = malloc_aligned(n_values * sizeof(uint16_t));
+        dataset->fixed_base = malloc(dataset->n_features * sizeof(double));
+        dataset->fixed_step = malloc(dataset->n_features * sizeof(double));
+    }
+
+    double* sorted = malloc(n * sizeof(double));
+    int merged_features = 0;
+    long merged_values = 0;
+
+    for (int f = 0; f < dataset->n_features; f++) {
+        size_t offset = (size_t)f * dataset->stride;
+        const double* column = &dataset->features[offset];
+        memcpy(sorted, column, n * sizeof(double));
+        merge_sort(sorted, n);
+
+        if (precision == PRECISION_FLOAT) {
+            float* target = &dataset->features32[offset];
+            for (int i = 0; i < n; i++) {
+                target[i] = (float)column[i];
+            }
+        } else {
+            double base = n > 0 ? sorted[0] : 0.0;
+            double range = n > 0 ? sorted[n - 1] - base : 0.0;
+            double step = range > 0.0 && range <= DBL_MAX ? range / FIXED16_MAX_CODE : 0.0;
+            uint16_t* target = &dataset->features16[offset];
+            for (int i = 0; i < n; i++) {
+                target[i] = fixed16_code(column[i], base, step);
+            }
+            dataset->fixed_base[f] = base;
+            dataset->fixed_step[f] = step;
+        }
+
+        // Adjacent distinct values that now read the same can no longer
+        // be separated by a split
+        long merged = 0;
+        for (int i = 0; i + 1 < n; i++) {
+            if (sorted[i] == sorted[i + 1]) continue;
+            if (precision == PRECISION_FLOAT) {
+                merged += (float)sorted[i] == (float)sorted[i + 1];
+            } else {
+                merged += fixed16_code(sorted[i], dataset->fixed_base[f], dataset->fixed_step[f]) ==
+                          fixed16_code(sorted[i + 1], dataset->fixed_base[f], dataset->fixed_step[f]);
+            }
+        }
+        if (merged > 0) merged_features++;
+        merged_values += merged;
+    }
+    free(sorted);
+
+    // A mapped cache keeps its pages; they are released with the dataset
+    if (!dataset->mapping) free(dataset->features);
+    dataset->features = NULL;
+    dataset->precision = precision;
+
+    printf("Storage precision: %s, %.2f MB of features (%.2f MB as double)\n",
+           precision_name(precision), n_values * precision_bytes(precision) / (1024.0 * 1024.0),
+           n_values * sizeof(double) / (1024.0 * 1024.0));
+    if (merged_values > 0) {
+        printf("  %d/%d features merge %ld pairs of distinct values; splits between them are lost\n",
+               merged_features, dataset->n_features, merged_values);
+    } else {
+        printf("  Every distinct value stays distinct; splits match the double path\n");
+    }
+}
+
+static int same_split(TreeNode* a, TreeNode* b) {
+    if (a->is_leaf != b->is_leaf) return 0;
+    if (a->is_leaf) return a->prediction == b->prediction;
+    return a->feature_index == b->feature_index && a->left_child == b->left_child &&
+           a->right_child == b->right_child;
+}
+
+// Predictions of the reference forest on test_data, taken while its columns
+// are still double so that input rounding shows up in the report
+int* predict_reference(RandomForest* reference, Dataset* test_data) {
+    int* predictions = malloc(test_data->n_samples * sizeof(int));
+
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        double* sample = malloc(test_data->n_features * sizeof(double));
+
+        #ifdef _OPENMP
+        #pragma omp for
+        #endif
+        for (int i = 0; i < test_data->n_samples; i++) {
+            get_sample(test_data, i, sample);
+            predictions[i] = predict_random_forest(reference, sample);
+        }
+
+        free(sample);
+    }
+    return predictions;
+}
+
+// Compares rf with reference, trained on double columns from the same
+// random state: tree structure, threshold shifts and test predictions
+// against reference_predictions from predict_reference
+void print_precision_report(RandomForest* reference, int* reference_predictions, RandomForest* rf,
+                            Dataset* test_data) {
+    int differing_trees = 0;
+    long differing_nodes = 0;
+    double max_shift = 0.0;
+
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* a = &reference->trees[t];
+        DecisionTree* b = &rf->trees[t];
+        int n_nodes = a->n_nodes < b->n_nodes ? a->n_nodes : b->n_nodes;
+        long differing = labs((long)a->n_nodes - b->n_nodes);
+
+        for (int i = 0; i < n_nodes; i++) {
+            if (!same_split(&a->nodes[i], &b->nodes[i])) {
+                differing++;
+            } else if (!a->nodes[i].is_leaf) {
+                double shift = fabs(a->nodes[i].threshold - b->nodes[i].threshold);
+                if (shift > max_shift) max_shift = shift;
+            }
+        }
+        if (differing > 0) differing_trees++;
+        differing_nodes += differing;
+    }
+
+    int differing_predictions = 0;
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        double* sample = malloc(test_data->n_features * sizeof(double));
+
+        #ifdef _OPENMP
+        #pragma omp for reduction(+:differing_predictions)
+        #endif
+        for (int i = 0; i < test_data->n_samples; i++) {
+            get_sample(test_data, i, sample);
+            differing_predictions += reference_predictions[i] != predict_random_forest(rf, sample);
+        }
+
+        free(sample);
+    }
+
+    printf("Precision check against double:\n");
+    printf("  Trees with different splits: %d/%d (%ld nodes)\n", differing_trees, rf->n_trees,
+           differing_nodes);
+    printf("  Largest threshold shift in matching splits: %g\n", max_shift);
+    printf("  Different test predictions: %d/%d\n", differing_predictions, test_data->n_samples);
+}
@@ -0,0 +1,236 @@
+#include "random_forest.h"
+
+// QuickScorer inference (Lucchese et al., SIGIR 2015). Every tree keeps a
+// bitvector of its leaves, numbered left to right. A sample goes right at
+// a node exactly when its value is not <= the threshold, and then no leaf
+// of the node's left subtree can be its exit leaf. Within a feature's node
+// list, sorted by threshold, the nodes a sample goes right at are a prefix;
+// clearing their left subtrees leaves the exit leaf as the lowest set bit
+// of every tree. Scoring is a binary search per feature and a run of ANDs
+// instead of a data-dependent walk. QUICKSCORER_LANES samples go through
+// each feature's list together, so the list is read from cache.
+//
+// Interleaving the lanes' bitvectors and comparing every node for all
+// lanes at once (V-QuickScorer) measured slower than the per-lane prefix
+// here: the lanes' prefixes differ, and every node must then be applied to
+// the longest of them.
+//
+// The work per sample grows with the nodes it goes right at, not with the
+// depth, so the engine is experimental: on the repo's datasets (deep trees
+// over five features, hundreds of nodes per feature) it scores about an
+// order of magnitude fewer rows per second than the tree walk. It pays off
+// for many shallow trees over many features.
+
+typedef struct {
+    int feature;
+    double threshold;
+    QuickScorerNode node;
+} NodeEntry;
+
+typedef struct {
+    QuickScorer* qs;
+    NodeEntry* entries;
+    int n_entries;
+    int first_word;    // Of the tree being compiled
+    int first_leaf;
+    int next_leaf;     // Leaves numbered so far in the tree
+} CompileState;
+
+static int compare_entries(const void* a, const void* b) {
+    const NodeEntry* x = a;
+    const NodeEntry* y = b;
+    if (x->feature != y->feature) return x->feature < y->feature ? -1 : 1;
+    if (x->threshold != y->threshold) return x->threshold < y->threshold ? -1 : 1;
+    return 0;
+}
+
+// Bits of a word at positions [from, to)
+static uint64_t bit_range(int from, int to) {
+    uint64_t below_to = to >= 64 ? ~0ULL : (1ULL << to) - 1;
+    return below_to & (~0ULL << from);
+}
+
+// Numbers the leaves below node left to right and records every internal node
+static void compile_subtree(CompileState* state, DecisionTree* tree, int node_idx) {
+    TreeNode* node = &tree->nodes[node_idx];
+    int first_leaf = state->next_leaf;
+    if (node->is_leaf) {
+        state->qs->leaf_class[state->first_leaf + state->next_leaf++] = node->prediction;
+        return;
+    }
+
+    compile_subtree(state, tree, node->left_child);
+    int end_left = state->next_leaf;
+    compile_subtree(state, tree, node->right_child);
+
+    // Going right removes the left subtree's leaves [first_leaf, end_left)
+    NodeEntry* entry = &state->entries[state->n_entries++];
+    entry->feature = node->feature_index;
+    entry->threshold = node->threshold;
+    entry->node.first_word = state->first_word + first_leaf / 64;
+    entry->node.last_word = state->first_word + (end_left - 1) / 64;
+    if (entry->node.first_word == entry->node.last_word) {
+        uint64_t cleared = bit_range(first_leaf % 64, (end_left - 1) % 64 + 1);
+        entry->node.first_keep = ~cleared;
+        entry->node.last_keep = ~cleared;
+    } else {
+        entry->node.first_keep = ~bit_range(first_leaf % 64, 64);
+        entry->node.last_keep = ~bit_range(0, (end_left - 1) % 64 + 1);
+    }
+}
+
+static int count_leaves(DecisionTree* tree) {
+    int n_leaves = 0;
+    for (int i = 0; i < tree->n_nodes; i++) {
+        n_leaves += tree->nodes[i].is_leaf;
+    }
+    return n_leaves > 0 ? n_leaves : 1;
+}
+
+QuickScorer* compile_quickscorer(RandomForest* rf) {
+    QuickScorer* qs = malloc(sizeof(QuickScorer));
+    qs->n_features = rf->n_features;
+    qs->n_trees = rf->n_trees;
+    qs->tree_words = malloc((rf->n_trees + 1) * sizeof(int));
+    qs->tree_leaves = malloc((rf->n_trees + 1) * sizeof(int));
+
+    // Words and leaves of every tree; a tree has one internal node fewer
+    // than leaves
+    int n_leaves = 0;
+    qs->n_words = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        int tree_leaves = count_leaves(&rf->trees[t]);
+        qs->tree_words[t] = qs->n_words;
+        qs->tree_leaves[t] = n_leaves;
+        qs->n_words += (tree_leaves + 63) / 64;
+        n_leaves += tree_leaves;
+    }
+    qs->tree_words[rf->n_trees] = qs->n_words;
+    qs->tree_leaves[rf->n_trees] = n_leaves;
+    qs->leaf_class = malloc(n_leaves * sizeof(int));
+
+    CompileState state;
+    state.qs = qs;
+    state.entries = malloc((n_leaves > rf->n_trees ? n_leaves - rf->n_trees : 1) * sizeof(NodeEntry));
+    state.n_entries = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        if (tree->n_nodes == 0) {
+            qs->leaf_class[qs->tree_leaves[t]] = 0;  // predict_tree's answer for an empty tree
+            continue;
+        }
+        state.first_word = qs->tree_words[t];
+        state.first_leaf = qs->tree_leaves[t];
+        state.next_leaf = 0;
+        compile_subtree(&state, tree, 0);
+    }
+
+    qsort(state.entries, state.n_entries, sizeof(NodeEntry), compare_entries);
+    qs->n_nodes = state.n_entries;
+    qs->offsets = calloc(qs->n_features + 1, sizeof(int));
+    qs->thresholds = malloc((state.n_entries > 0 ? state.n_entries : 1) * sizeof(double));
+    qs->nodes = malloc((state.n_entries > 0 ? state.n_entries : 1) * sizeof(QuickScorerNode));
+    for (int k = 0; k < state.n_entries; k++) {
+        qs->offsets[state.entries[k].feature + 1]++;
+        qs->thresholds[k] = state.entries[k].threshold;
+        qs->nodes[k] = state.entries[k].node;
+    }
+    for (int f = 0; f < qs->n_features; f++) {
+        qs->offsets[f + 1] += qs->offsets[f];
+    }
+    free(state.entries);
+
+    printf("QuickScorer: %d nodes over %d features, %d bitvector words, %.1f KB\n",
+           qs->n_nodes, qs->n_features, qs->n_words,
+           (qs->n_nodes * (sizeof(double) + sizeof(QuickScorerNode)) +
+            n_leaves * sizeof(int)) / 1024.0);
+    return qs;
+}
+
+void free_quickscorer(QuickScorer* qs) {
+    if (!qs) return;
+    free(qs->offsets);
+    free(qs->thresholds);
+    free(qs->nodes);
+    free(qs->tree_words);
+    free(qs->tree_leaves);
+    free(qs->leaf_class);
+    free(qs);
+}
+
+// Features with at most this many nodes are scanned instead of searched
+#define QUICKSCORER_SCAN 16
+
+// Number of thresholds of [thresholds, thresholds + n) that x goes right
+// at: the nodes it goes left at are a suffix, since x <= t stays true as t
+// grows. A NaN goes right everywhere, as in predict_tree.
+static int count_right(const double* thresholds, int n, double x) {
+    if (n <= QUICKSCORER_SCAN) {
+        int k = 0;
+        while (k < n && !(x <= thresholds[k])) k++;
+        return k;
+    }
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (x <= thresholds[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Adds the vote of every tree for the n rows of X (row-major, stride
+// columns) to votes[i * n_classes + class]
+void quickscorer_votes(QuickScorer* qs, double* X, int n, int stride, int* votes, int n_classes) {
+    uint64_t* bits = malloc_aligned((size_t)qs->n_words * QUICKSCORER_LANES * sizeof(uint64_t));
+
+    for (int first = 0; first < n; first += QUICKSCORER_LANES) {
+        int lanes = n - first < QUICKSCORER_LANES ? n - first : QUICKSCORER_LANES;
+        for (size_t i = 0; i < (size_t)qs->n_words * lanes; i++) {
+            bits[i] = ~0ULL;
+        }
+
+        // The lanes share each feature's node list while it is in cache
+        for (int f = 0; f < qs->n_features; f++) {
+            int begin = qs->offsets[f];
+            int n_nodes = qs->offsets[f + 1] - begin;
+            if (n_nodes == 0) continue;
+
+            for (int s = 0; s < lanes; s++) {
+                uint64_t* lane = &bits[(size_t)s * qs->n_words];
+                int n_right = count_right(&qs->thresholds[begin], n_nodes,
+                                          X[(size_t)(first + s) * stride + f]);
+                const QuickScorerNode* node = &qs->nodes[begin];
+
+                for (int k = 0; k < n_right; k++, node++) {
+                    if (node->first_word == node->last_word) {
+                        lane[node->first_word] &= node->first_keep;
+                        continue;
+                    }
+                    lane[node->first_word] &= node->first_keep;
+                    for (int w = node->first_word + 1; w < node->last_word; w++) {
+                        lane[w] = 0;
+                    }
+                    lane[node->last_word] &= node->last_keep;
+                }
+            }
+        }
+
+        // Exit leaf: lowest set bit of each tree
+        for (int s = 0; s < lanes; s++) {
+            uint64_t* lane = &bits[(size_t)s * qs->n_words];
+            int* sample_votes = &votes[(first + s) * n_classes];
+            for (int t = 0; t < qs->n_trees; t++) {
+                int w = qs->tree_words[t];
+                while (lane[w] == 0) w++;
+                int leaf = (w - qs->tree_words[t]) * 64 + __builtin_ctzll(lane[w]);
+                sample_votes[qs->leaf_class[qs->tree_leaves[t] + leaf]]++;
+            }
+        }
+    }
+
+    free(bits);
+}
@@ -0,0 +1,50 @@
+#include "random_forest.h"
+
+// Counter-based random numbers. Draw k of a stream is mix64(key + k * gamma),
+// the SplitMix64 output function, with a key derived from (seed, stream id).
+// Streams hold no shared state, so each tree draws from its own stream on
+// whichever thread trains it and the forest does not depend on the schedule.
+
+#define RANDOM_GAMMA 0x9E3779B97F4A7C15ULL
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+RandomStream random_stream(uint64_t seed, uint64_t stream_id) {
+    RandomStream rng;
+    rng.key = mix64(seed ^ mix64(stream_id + RANDOM_GAMMA));
+    rng.counter = 0;
+    return rng;
+}
+
+// Draw counter of rng, without advancing it
+uint64_t random_at(const RandomStream* rng, uint64_t counter) {
+    return mix64(rng->key + (counter + 1) * RANDOM_GAMMA);
+}
+
+uint64_t random_next(RandomStream* rng) {
+    return random_at(rng, rng->counter++);
+}
+
+// Uniform in [0, n), without the modulo bias of rand() % n (Lemire's
+// multiply-and-reject method)
+uint32_t random_below(RandomStream* rng, uint32_t n) {
+    uint64_t product = (random_next(rng) >> 32) * n;
+    if ((uint32_t)product < n) {
+        uint32_t threshold = -n % n;
+        while ((uint32_t)product < threshold) {
+            product = (random_next(rng) >> 32) * n;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+// Uniform in [0, 1) from the top 53 bits of a draw
+double random_unit(uint64_t bits) {
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,295 @@
+#include "random_forest.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Every kernel scores a candidate as left_sq / n_left + right_sq / n_right with
+// the sums of squared class counts already converted to double (exact while
+// n_samples < 2^26). Each lane therefore performs exactly the same IEEE
+// operations as the scalar loop, which keeps all paths bit-identical.
+
+// Running sums of squared class counts for every split position i, meaning
+// samples [0, i] go left. Inherently sequential, shared by all paths.
+static void prefix_squares(const int* labels, int n, const int* node_counts, int n_classes,
+                           int* left_counts, double* left_sq, double* right_sq) {
+    long long left = 0, right = 0;
+
+    for (int c = 0; c < n_classes; c++) {
+        left_counts[c] = 0;
+        right += (long long)node_counts[c] * node_counts[c];
+    }
+
+    for (int i = 0; i < n - 1; i++) {
+        int label = labels[i];
+        left += 2LL * left_counts[label] + 1;
+        left_counts[label]++;
+        right -= 2LL * (node_counts[label] - left_counts[label]) + 1;
+        left_sq[i] = (double)left;
+        right_sq[i] = (double)right;
+    }
+}
+
+// Scalar reference implementations
+
+static int partition_scalar(const double* values, int n, double threshold, uint8_t* goes_left) {
+    int left_count = 0;
+    for (int i = 0; i < n; i++) {
+        goes_left[i] = values[i] <= threshold;
+        left_count += goes_left[i];
+    }
+    return left_count;
+}
+
+static void count_classes_scalar(const int* labels, int n, int n_classes, int* counts) {
+    (void)n_classes;
+    for (int i = 0; i < n; i++) {
+        counts[labels[i]]++;
+    }
+}
+
+static int best_split_scalar(const double* values, const int* labels, int n, const int* node_counts,
+                             int n_classes, int min_leaf, int* left_counts, double* sq,
+                             double* best_score) {
+    double* left_sq = sq;
+    double* right_sq = sq + n;
+    prefix_squares(labels, n, node_counts, n_classes, left_counts, left_sq, right_sq);
+
+    int best = -1;
+    *best_score = -1.0;
+    for (int i = min_leaf - 1; i < n - min_leaf; i++) {
+        if (values[i] == values[i + 1]) continue;
+        double score = left_sq[i] / (double)(i + 1) + right_sq[i] / (double)(n - i - 1);
+        if (score > *best_score) {
+            *best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static const SplitKernels scalar_kernels = {
+    "scalar", partition_scalar, count_classes_scalar, best_split_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+// AVX2: 4 doubles / 8 ints per vector
+
+__attribute__((target("avx2,popcnt")))
+static int partition_avx2(const double* values, int n, double threshold, uint8_t* goes_left) {
+    __m256d t = _mm256_set1_pd(threshold);
+    int left_count = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(&values[i]), t, _CMP_LE_OQ));
+        goes_left[i] = mask & 1;
+        goes_left[i + 1] = (mask >> 1) & 1;
+        goes_left[i + 2] = (mask >> 2) & 1;
+        goes_left[i + 3] = (mask >> 3) & 1;
+        left_count += __builtin_popcount(mask);
+    }
+    return left_count + partition_scalar(&values[i], n - i, threshold, &goes_left[i]);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void count_classes_avx2(const int* labels, int n, int n_classes, int* counts) {
+    // One compare per class and vector; only worth it for a few classes
+    if (n_classes > 16) {
+        count_classes_scalar(labels, n, n_classes, counts);
+        return;
+    }
+
+    int tail = n - n % 8;
+    for (int c = 0; c < n_classes; c++) {
+        __m256i label = _mm256_set1_epi32(c);
+        int count = 0;
+        for (int i = 0; i < tail; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)&labels[i]);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, label)));
+            count += __builtin_popcount(mask);
+        }
+        counts[c] += count;
+    }
+    count_classes_scalar(&labels[tail], n - tail, n_classes, counts);
+}
+
+__attribute__((target("avx2")))
+static int best_split_avx2(const double* values, const int* labels, int n, const int* node_counts,
+                           int n_classes, int min_leaf, int* left_counts, double* sq,
+                           double* best_score) {
+    double* left_sq = sq;
+    double* right_sq = sq + n;
+    prefix_squares(labels, n, node_counts, n_classes, left_counts, left_sq, right_sq);
+
+    int m = n - min_leaf; // End of the candidate positions
+    int best = -1;
+    *best_score = -1.0;
+
+    int i = min_leaf - 1;
+    __m256d total = _mm256_set1_pd((double)n);
+    __m256d pos = _mm256_set_pd(i + 4.0, i + 3.0, i + 2.0, i + 1.0); // n_left of lanes 0..3
+    __m256d step = _mm256_set1_pd(4.0);
+    __m256d invalid = _mm256_set1_pd(-1.0);
+    double scores[4];
+
+    for (; i + 4 <= m; i += 4) {
+        __m256d n_left = pos;
+        __m256d n_right = _mm256_sub_pd(total, n_left);
+        __m256d score = _mm256_add_pd(_mm256_div_pd(_mm256_loadu_pd(&left_sq[i]), n_left),
+                                      _mm256_div_pd(_mm256_loadu_pd(&right_sq[i]), n_right));
+        __m256d same = _mm256_cmp_pd(_mm256_loadu_pd(&values[i]), _mm256_loadu_pd(&values[i + 1]),
+                                     _CMP_EQ_OQ);
+        score = _mm256_blendv_pd(score, invalid, same);
+        pos = _mm256_add_pd(pos, step);
+
+        // Only inspect the lanes when the block can beat the current best
+        __m256d beats = _mm256_cmp_pd(score, _mm256_set1_pd(*best_score), _CMP_GT_OQ);
+        if (_mm256_movemask_pd(beats)) {
+            _mm256_storeu_pd(scores, score);
+            for (int k = 0; k < 4; k++) {
+                if (scores[k] > *best_score) {
+                    *best_score = scores[k];
+                    best = i + k;
+                }
+            }
+        }
+    }
+
+    for (; i < m; i++) {
+        if (values[i] == values[i + 1]) continue;
+        double score = left_sq[i] / (double)(i + 1) + right_sq[i] / (double)(n - i - 1);
+        if (score > *best_score) {
+            *best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static const SplitKernels avx2_kernels = {
+    "avx2", partition_avx2, count_classes_avx2, best_split_avx2
+};
+
+// AVX-512: 8 doubles / 16 ints per vector, native compare masks
+
+__attribute__((target("avx512f,popcnt")))
+static int partition_avx512(const double* values, int n, double threshold, uint8_t* goes_left) {
+    __m512d t = _mm512_set1_pd(threshold);
+    int left_count = 0;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 mask = _mm512_cmp_pd_mask(_mm512_loadu_pd(&values[i]), t, _CMP_LE_OQ);
+        for (int k = 0; k < 8; k++) {
+            goes_left[i + k] = (mask >> k) & 1;
+        }
+        left_count += __builtin_popcount(mask);
+    }
+    return left_count + partition_scalar(&values[i], n - i, threshold, &goes_left[i]);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static void count_classes_avx512(const int* labels, int n, int n_classes, int* counts) {
+    if (n_classes > 16) {
+        count_classes_scalar(labels, n, n_classes, counts);
+        return;
+    }
+
+    int tail = n - n % 16;
+    for (int c = 0; c < n_classes; c++) {
+        __m512i label = _mm512_set1_epi32(c);
+        int count = 0;
+        for (int i = 0; i < tail; i += 16) {
+            __m512i v = _mm512_loadu_si512((const void*)&labels[i]);
+            count += __builtin_popcount(_mm512_cmpeq_epi32_mask(v, label));
+        }
+        counts[c] += count;
+    }
+    count_classes_scalar(&labels[tail], n - tail, n_classes, counts);
+}
+
+__attribute__((target("avx512f")))
+static int best_split_avx512(const double* values, const int* labels, int n, const int* node_counts,
+                             int n_classes, int min_leaf, int* left_counts, double* sq,
+                             double* best_score) {
+    double* left_sq = sq;
+    double* right_sq = sq + n;
+    prefix_squares(labels, n, node_counts, n_classes, left_counts, left_sq, right_sq);
+
+    int m = n - min_leaf;
+    int best = -1;
+    *best_score = -1.0;
+
+    int i = min_leaf - 1;
+    __m512d total = _mm512_set1_pd((double)n);
+    __m512d pos = _mm512_set_pd(i + 8.0, i + 7.0, i + 6.0, i + 5.0,
+                                i + 4.0, i + 3.0, i + 2.0, i + 1.0);
+    __m512d step = _mm512_set1_pd(8.0);
+    double scores[8];
+
+    for (; i + 8 <= m; i += 8) {
+        __m512d n_left = pos;
+        __m512d n_right = _mm512_sub_pd(total, n_left);
+        __m512d score = _mm512_add_pd(_mm512_div_pd(_mm512_loadu_pd(&left_sq[i]), n_left),
+                                      _mm512_div_pd(_mm512_loadu_pd(&right_sq[i]), n_right));
+        __mmask8 distinct = _mm512_cmp_pd_mask(_mm512_loadu_pd(&values[i]),
+                                               _mm512_loadu_pd(&values[i + 1]), _CMP_NEQ_UQ);
+        pos = _mm512_add_pd(pos, step);
+
+        __mmask8 beats = _mm512_mask_cmp_pd_mask(distinct, score, _mm512_set1_pd(*best_score),
+                                                 _CMP_GT_OQ);
+        if (beats) {
+            _mm512_storeu_pd(scores, score);
+            for (int k = 0; k < 8; k++) {
+                if (((beats >> k) & 1) && scores[k] > *best_score) {
+                    *best_score = scores[k];
+                    best = i + k;
+                }
+            }
+        }
+    }
+
+    for (; i < m; i++) {
+        if (values[i] == values[i + 1]) continue;
+        double score = left_sq[i] / (double)(i + 1) + right_sq[i] / (double)(n - i - 1);
+        if (score > *best_score) {
+            *best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static const SplitKernels avx512_kernels = {
+    "avx512", partition_avx512, count_classes_avx512, best_split_avx512
+};
+
+#endif // HAVE_X86_KERNELS
+
+// Fills kernels with every implementation this CPU can run, scalar first
+int get_available_split_kernels(const SplitKernels** kernels) {
+    int n = 0;
+    kernels[n++] = &scalar_kernels;
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        kernels[n++] = &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt")) {
+        kernels[n++] = &avx512_kernels;
+    }
+#endif
+
+    return n;
+}
+
+// Widest implementation supported by the CPU
+const SplitKernels* get_split_kernels(void) {
+    const SplitKernels* kernels[MAX_SPLIT_KERNELS];
+    int n = get_available_split_kernels(kernels);
+    return kernels[n - 1];
+}
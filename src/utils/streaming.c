@@ -0,0 +1,688 @@
+#define _XOPEN_SOURCE 600  // pread
+#include "random_forest.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Out-of-core training. The data is never resident: it is read in chunks
+// from a CSV file or a binary cache, once per pass. A first pass counts the
+// rows and keeps a reservoir sample that places the bin edges. Trees then
+// grow level by level: every pass routes each training row through the
+// partially built trees and adds it to the class histogram of the frontier
+// node it reaches. One pass per level covers all trees when their frontier
+// histograms fit in the memory limit, otherwise the frontier is split into
+// batches that each take a pass.
+//
+// Rows are assigned to the test set and weighted for each tree's bootstrap
+// by draw number row of counter-based random streams keyed by the seed, so
+// no per-row state is stored. A bootstrap
+// drawn with replacement gives every row a Binomial(n, 1/n) multiplicity,
+// which the Poisson(1) weights used here approximate.
+
+#define STREAM_CSV_BLOCK (1 << 20)
+#define STREAM_SAMPLE_ROWS 200000   // Reservoir that places the bin edges
+#define STREAM_MIN_CHUNK_ROWS 256
+#define STREAM_MAX_CHUNK_ROWS (1 << 20)
+#define STREAM_MAX_WEIGHT 16        // Poisson(1) tail beyond this is < 1e-14
+// Random stream ids. Tree t selects its features from stream t, as in
+// resident training, and weighs its rows with stream STREAM_WEIGHT_ID + t.
+#define STREAM_SPLIT_ID (UINT64_MAX - 1)
+#define STREAM_SAMPLE_ID (UINT64_MAX - 2)
+#define STREAM_WEIGHT_ID (1ULL << 32)
+
+typedef struct {
+    int is_cache;
+    int n_features;
+    long long next_row;      // Row id of the next row to read
+    // Binary cache
+    int fd;
+    DatasetCacheHeader header;
+    // CSV
+    FILE *file;
+    char *buffer;
+    size_t capacity;
+    size_t begin;
+    size_t end;
+    int eof;
+} DataStream;
+
+typedef struct {
+    int tree;
+    int node;
+} StreamSlot;
+
+// Draw row of the split stream decides whether a row is held out
+static int is_test_row(const RandomStream* split, double train_ratio, long long row) {
+    return random_unit(random_at(split, row)) >= train_ratio;
+}
+
+static int poisson_weight(const double* cdf, const RandomStream* weights, long long row) {
+    double u = random_unit(random_at(weights, row));
+    int k = 0;
+    while (k < STREAM_MAX_WEIGHT && u >= cdf[k]) k++;
+    return k;
+}
+
+static void poisson_cdf(double* cdf) {
+    double p = exp(-1.0), total = 0.0;
+    for (int k = 0; k < STREAM_MAX_WEIGHT; k++) {
+        total += p;
+        cdf[k] = total;
+        p /= k + 1;
+    }
+}
+
+// Data sources
+
+static int read_fully(int fd, void* buffer, size_t bytes, uint64_t offset) {
+    char* p = buffer;
+    while (bytes > 0) {
+        ssize_t n = pread(fd, p, bytes, (off_t)offset);
+        if (n <= 0) return 0;
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return 1;
+}
+
+// Next line of a CSV stream, without its terminator. Lines of any length
+// are supported: the buffer grows until it holds the whole line.
+static int csv_next_line(DataStream* stream, const char** line, const char** line_end) {
+    for (;;) {
+        char* begin = stream->buffer + stream->begin;
+        char* newline = memchr(begin, '\n', stream->end - stream->begin);
+        if (newline || (stream->eof && stream->begin < stream->end)) {
+            char* end = newline ? newline : stream->buffer + stream->end;
+            stream->begin = newline ? (size_t)(newline + 1 - stream->buffer) : stream->end;
+            if (end > begin && end[-1] == '\r') end--;
+            *line = begin;
+            *line_end = end;
+            return 1;
+        }
+        if (stream->eof) return 0;
+
+        memmove(stream->buffer, begin, stream->end - stream->begin);
+        stream->end -= stream->begin;
+        stream->begin = 0;
+        if (stream->end == stream->capacity) {
+            stream->capacity *= 2;
+            stream->buffer = realloc(stream->buffer, stream->capacity);
+        }
+        size_t n = fread(stream->buffer + stream->end, 1, stream->capacity - stream->end,
+                         stream->file);
+        stream->end += n;
+        if (n == 0) stream->eof = 1;
+    }
+}
+
+// Positions the stream on the first data row
+static int rewind_stream(DataStream* stream) {
+    stream->next_row = 0;
+    if (stream->is_cache) return 1;
+
+    rewind(stream->file);
+    stream->begin = stream->end = 0;
+    stream->eof = 0;
+    const char* line;
+    const char* line_end;
+    if (!csv_next_line(stream, &line, &line_end)) return 0;
+    stream->n_features = count_csv_columns(line, line_end) - 1;
+    return stream->n_features >= 1;
+}
+
+static void close_stream(DataStream* stream) {
+    if (stream->is_cache) {
+        close(stream->fd);
+    } else {
+        fclose(stream->file);
+        free(stream->buffer);
+    }
+}
+
+static int open_stream(DataStream* stream, const char* filename) {
+    memset(stream, 0, sizeof(DataStream));
+    stream->fd = open(filename, O_RDONLY);
+    if (stream->fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return 0;
+    }
+
+    struct stat info;
+    DatasetCacheHeader* header = &stream->header;
+    if (fstat(stream->fd, &info) == 0 && read_fully(stream->fd, header, sizeof(*header), 0) &&
+        is_dataset_cache(header, (size_t)info.st_size)) {
+        if (!check_cache_header(header, (size_t)info.st_size)) {
+            fprintf(stderr, "Error: %s is not a valid dataset cache\n", filename);
+            close(stream->fd);
+            return 0;
+        }
+        stream->is_cache = 1;
+        stream->n_features = header->n_features;
+        return 1;
+    }
+    close(stream->fd);
+
+    stream->file = fopen(filename, "rb");
+    stream->capacity = STREAM_CSV_BLOCK;
+    stream->buffer = malloc(stream->capacity);
+    if (!stream->file || !rewind_stream(stream)) {
+        fprintf(stderr, "Error: %s needs a header with at least one feature and a label\n",
+                filename);
+        if (stream->file) fclose(stream->file);
+        free(stream->buffer);
+        return 0;
+    }
+    return 1;
+}
+
+// Reads up to chunk->stride rows into chunk. Returns the number of rows,
+// 0 at the end of the data and -1 on a read or format error.
+static int read_chunk(DataStream* stream, Dataset* chunk) {
+    int capacity = chunk->stride;
+    int n_rows = 0;
+
+    if (stream->is_cache) {
+        long long remaining = (long long)stream->header.n_samples - stream->next_row;
+        n_rows = remaining < capacity ? (int)remaining : capacity;
+        for (int f = 0; f < chunk->n_features && n_rows > 0; f++) {
+            uint64_t offset = stream->header.features_offset +
+                              ((uint64_t)f * stream->header.stride + stream->next_row) * sizeof(double);
+            if (!read_fully(stream->fd, &chunk->features[(size_t)f * chunk->stride],
+                            n_rows * sizeof(double), offset)) return -1;
+        }
+        if (n_rows > 0 &&
+            !read_fully(stream->fd, chunk->labels, n_rows * sizeof(int32_t),
+                        stream->header.labels_offset + stream->next_row * sizeof(int32_t))) {
+            return -1;
+        }
+    } else {
+        const char* line;
+        const char* line_end;
+        while (n_rows < capacity && csv_next_line(stream, &line, &line_end)) {
+            if (line_end == line) continue;
+            if (!parse_csv_row(line, line_end, chunk, n_rows)) {
+                fprintf(stderr, "Error: data row %lld has fewer than %d columns\n",
+                        stream->next_row + n_rows + 1, chunk->n_features + 1);
+                return -1;
+            }
+            n_rows++;
+        }
+    }
+
+    chunk->n_samples = n_rows;
+    stream->next_row += n_rows;
+    return n_rows;
+}
+
+// Rows per chunk: an eighth of the limit for the values and bin codes
+static int stream_chunk_rows(StreamParams* params, int n_features) {
+    size_t row_bytes = n_features * (sizeof(double) + sizeof(uint8_t)) + sizeof(int) + 1;
+    size_t chunk_rows = params->memory_limit / 8 / row_bytes;
+    if (chunk_rows < STREAM_MIN_CHUNK_ROWS) chunk_rows = STREAM_MIN_CHUNK_ROWS;
+    if (chunk_rows > STREAM_MAX_CHUNK_ROWS) chunk_rows = STREAM_MAX_CHUNK_ROWS;
+    return (int)(chunk_rows - chunk_rows % (CACHE_LINE / sizeof(double)));
+}
+
+// Training
+
+static int add_node(DecisionTree* tree) {
+    if (tree->n_nodes == tree->capacity) {
+        tree->capacity *= 2;
+        tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(TreeNode));
+    }
+    TreeNode* node = &tree->nodes[tree->n_nodes];
+    node->feature_index = -1;
+    node->threshold = 0.0;
+    node->left_child = -1;
+    node->right_child = -1;
+    node->prediction = 0;
+    node->is_leaf = 1;
+    return tree->n_nodes++;
+}
+
+static int majority_class(const int64_t* counts, int n_classes) {
+    int majority = 0;
+    for (int c = 1; c < n_classes; c++) {
+        if (counts[c] > counts[majority]) majority = c;
+    }
+    return majority;
+}
+
+// Best split after bin b of one feature histogram, scored like the exact
+// search as sum(left^2)/n_left + sum(right^2)/n_right. Returns -1.0 if no
+// bin leaves min_leaf weight on both sides; left is scratch.
+static double sweep_stream_histogram(const int64_t* hist, int n_bins, const int64_t* node_counts,
+                                     int n_classes, int64_t n, int64_t min_leaf,
+                                     int64_t* left, int* best_bin) {
+    int64_t n_left = 0;
+    double best_score = -1.0;
+    memset(left, 0, n_classes * sizeof(int64_t));
+
+    for (int b = 0; b < n_bins - 1; b++) {
+        int64_t added = 0;
+        for (int c = 0; c < n_classes; c++) {
+            left[c] += hist[b * n_classes + c];
+            added += hist[b * n_classes + c];
+        }
+        n_left += added;
+        if (added == 0 || n_left < min_leaf) continue;
+        if (n - n_left < min_leaf) break;
+
+        double left_sq = 0.0, right_sq = 0.0;
+        for (int c = 0; c < n_classes; c++) {
+            double l = (double)left[c], r = (double)(node_counts[c] - left[c]);
+            left_sq += l * l;
+            right_sq += r * r;
+        }
+        double score = left_sq / n_left + right_sq / (n - n_left);
+        if (score > best_score) {
+            best_score = score;
+            *best_bin = b;
+        }
+    }
+    return best_score;
+}
+
+// Chooses the split of a frontier node from its histograms, or leaves it a
+// leaf. Children that can still split are appended to next.
+static void split_stream_node(RandomForest* rf, BinMapper* bins, int** features, int n_classes,
+                              const int64_t* hist, size_t feature_stride, StreamSlot slot,
+                              int depth, double* root_weight, StreamSlot* next, int* n_next) {
+    DecisionTree* tree = &rf->trees[slot.tree];
+    TreeParams* params = &rf->params;
+    int64_t* counts = calloc(n_classes, sizeof(int64_t));
+    int64_t* left = malloc(n_classes * sizeof(int64_t));
+    int64_t* best_left = malloc(n_classes * sizeof(int64_t));
+    int64_t* right = malloc(n_classes * sizeof(int64_t));
+
+    // Every row of the node lands in one bin of the first feature
+    int64_t n = 0;
+    for (int b = 0; b < bins->n_bins[features[slot.tree][0]]; b++) {
+        for (int c = 0; c < n_classes; c++) {
+            counts[c] += hist[b * n_classes + c];
+            n += hist[b * n_classes + c];
+        }
+    }
+    if (slot.node == 0) root_weight[slot.tree] = (double)n;
+    int majority = majority_class(counts, n_classes);
+    tree->nodes[slot.node].prediction = majority;
+
+    int64_t min_leaf = params->min_samples_leaf > 0 ? params->min_samples_leaf : 1;
+    int best_feature = -1, best_bin = 0;
+    double best_score = -1.0;
+    if (depth < params->max_depth && n >= params->min_samples_split && n >= 2 &&
+        counts[majority] != n) {
+        for (int k = 0; k < rf->n_features_per_tree; k++) {
+            int f = features[slot.tree][k];
+            int bin = 0;
+            double score = sweep_stream_histogram(&hist[k * feature_stride], bins->n_bins[f], counts,
+                                                  n_classes, n, min_leaf, left, &bin);
+            if (score > best_score) {
+                best_score = score;
+                best_feature = k;
+                best_bin = bin;
+            }
+        }
+    }
+
+    double node_sq = 0.0;
+    for (int c = 0; c < n_classes; c++) node_sq += (double)counts[c] * counts[c];
+    double current = n > 0 ? node_sq / n : 0.0;
+    double min_gain = params->min_impurity_decrease * root_weight[slot.tree];
+
+    if (best_feature >= 0 && best_score > current * (1.0 + 1e-12) &&
+        best_score - current >= min_gain) {
+        int f = features[slot.tree][best_feature];
+        int left_child = add_node(tree);
+        int right_child = add_node(tree);
+        TreeNode* node = &tree->nodes[slot.node];
+        node->is_leaf = 0;
+        node->feature_index = f;
+        node->threshold = bins->edges[f][best_bin];
+        node->left_child = left_child;
+        node->right_child = right_child;
+
+        // Class counts of the rows in bins up to best_bin go left
+        const int64_t* feature_hist = &hist[best_feature * feature_stride];
+        int64_t n_left = 0;
+        memset(best_left, 0, n_classes * sizeof(int64_t));
+        for (int b = 0; b <= best_bin; b++) {
+            for (int c = 0; c < n_classes; c++) best_left[c] += feature_hist[b * n_classes + c];
+        }
+        for (int c = 0; c < n_classes; c++) {
+            right[c] = counts[c] - best_left[c];
+            n_left += best_left[c];
+        }
+        tree->nodes[left_child].prediction = majority_class(best_left, n_classes);
+        tree->nodes[right_child].prediction = majority_class(right, n_classes);
+
+        // Children at the depth limit, pure or too small to split stay leaves
+        if (depth + 1 < params->max_depth) {
+            if (n_left >= params->min_samples_split &&
+                best_left[tree->nodes[left_child].prediction] != n_left) {
+                next[(*n_next)++] = (StreamSlot){slot.tree, left_child};
+            }
+            if (n - n_left >= params->min_samples_split &&
+                right[tree->nodes[right_child].prediction] != n - n_left) {
+                next[(*n_next)++] = (StreamSlot){slot.tree, right_child};
+            }
+        }
+    }
+
+    free(counts);
+    free(left);
+    free(best_left);
+    free(right);
+}
+
+// First pass: counts the rows and classes and samples training rows for
+// the bin edges
+static BinMapper* scan_stream(DataStream* stream, Dataset* chunk, StreamParams* params,
+                              int sample_rows, long long* n_train, long long* n_test,
+                              int* n_classes) {
+    Dataset* sample = create_dataset(sample_rows, stream->n_features);
+    RandomStream split = random_stream(params->seed, STREAM_SPLIT_ID);
+    RandomStream reservoir = random_stream(params->seed, STREAM_SAMPLE_ID);
+    long long seen = 0;
+    int max_label = 0;
+    *n_train = *n_test = 0;
+
+    int n_rows;
+    while ((n_rows = read_chunk(stream, chunk)) > 0) {
+        long long first_row = stream->next_row - n_rows;
+        for (int i = 0; i < n_rows; i++) {
+            long long row = first_row + i;
+            if (chunk->labels[i] > max_label) max_label = chunk->labels[i];
+            if (is_test_row(&split, params->train_ratio, row)) {
+                (*n_test)++;
+                continue;
+            }
+            (*n_train)++;
+
+            // Reservoir sampling: row k replaces a random slot with
+            // probability sample_rows / (k + 1)
+            long long slot = seen < sample_rows ? seen
+                           : (long long)(random_unit(random_at(&reservoir, seen)) * (seen + 1));
+            seen++;
+            if (slot >= sample_rows) continue;
+            for (int f = 0; f < stream->n_features; f++) {
+                sample->features[(size_t)f * sample->stride + slot] =
+                    chunk->features[(size_t)f * chunk->stride + i];
+            }
+            sample->labels[slot] = chunk->labels[i];
+        }
+    }
+
+    BinMapper* bins = NULL;
+    if (n_rows == 0 && seen > 0) {
+        sample->n_samples = seen < sample_rows ? (int)seen : sample_rows;
+        bins = create_bin_mapper(sample, params->max_bins);
+    }
+    free_dataset(sample);
+    *n_classes = max_label + 1;
+    return bins;
+}
+
+// Trains rf on the rows of filename that the split hash assigns to training.
+// The bin mapper is returned in params->bins. Returns 0 on success.
+int train_streaming_forest(RandomForest* rf, const char* filename, StreamParams* params) {
+    DataStream stream;
+    if (!open_stream(&stream, filename)) return -1;
+    int n_features = stream.n_features;
+    if (rf->n_features_per_tree <= 0 || rf->n_features_per_tree > n_features) {
+        rf->n_features_per_tree = (int)sqrt(n_features);
+        if (rf->n_features_per_tree < 1) rf->n_features_per_tree = 1;
+    }
+    // The sample is freed before the histograms are allocated, so it may use
+    // a larger share of the limit than the chunk
+    size_t sample_rows = params->memory_limit / 4 / (n_features * sizeof(double) + sizeof(int));
+    if (sample_rows > STREAM_SAMPLE_ROWS) sample_rows = STREAM_SAMPLE_ROWS;
+    if (sample_rows < 2) sample_rows = 2;
+
+    Dataset* chunk = create_dataset(stream_chunk_rows(params, n_features), n_features);
+    uint8_t* codes = malloc_aligned((size_t)n_features * chunk->stride);
+
+    long long n_train, n_test;
+    int n_classes;
+    params->bins = scan_stream(&stream, chunk, params, (int)sample_rows, &n_train, &n_test,
+                               &n_classes);
+    BinMapper* bins = params->bins;
+    if (!bins) {
+        fprintf(stderr, "Error: no training rows in %s\n", filename);
+        free(codes);
+        free_dataset(chunk);
+        close_stream(&stream);
+        return -1;
+    }
+    printf("Streaming %s: %lld train / %lld test rows, %d features, %d classes\n", filename,
+           n_train, n_test, n_features, n_classes);
+
+    // Trees start as a root leaf each, with their own feature subset
+    int** features = malloc(rf->n_trees * sizeof(int*));
+    int** slot_of = malloc(rf->n_trees * sizeof(int*));
+    double* root_weight = calloc(rf->n_trees, sizeof(double));
+    RandomStream* weights = malloc(rf->n_trees * sizeof(RandomStream));
+    RandomStream split = random_stream(params->seed, STREAM_SPLIT_ID);
+    for (int t = 0; t < rf->n_trees; t++) {
+        DecisionTree* tree = &rf->trees[t];
+        tree->capacity = 64;   // Grown by add_node, within the memory plan
+        tree->nodes = malloc(tree->capacity * sizeof(TreeNode));
+        tree->n_nodes = 0;
+        add_node(tree);
+        RandomStream rng = random_stream(params->seed, t);
+        features[t] = generate_random_features(n_features, rf->n_features_per_tree, &rng);
+        weights[t] = random_stream(params->seed, STREAM_WEIGHT_ID + t);
+        slot_of[t] = NULL;
+    }
+
+    // Chunks are fixed; trees and frontier histograms share the rest of the
+    // limit, re-planned at every level as the trees grow
+    int max_depth = rf->params.max_depth > 0 ? rf->params.max_depth : 1;
+    size_t chunk_bytes = (size_t)n_features * chunk->stride * (sizeof(double) + sizeof(uint8_t)) +
+                         chunk->stride * (sizeof(int) + sizeof(uint8_t)) + STREAM_CSV_BLOCK;
+    size_t feature_stride = (size_t)bins->max_bins * n_classes;
+    size_t slot_ints = rf->n_features_per_tree * feature_stride;
+    // A slot also holds its frontier entries and the two children it may add
+    size_t slot_bytes = slot_ints * sizeof(int64_t) + 3 * sizeof(StreamSlot) +
+                        2 * (sizeof(TreeNode) + sizeof(FlatNode) + sizeof(int));
+    printf("Memory plan: %.1f MB of %d-row chunks, %.3f MB per node histogram\n",
+           chunk_bytes / 1048576.0, chunk->stride, slot_bytes / 1048576.0);
+
+    double cdf[STREAM_MAX_WEIGHT];
+    poisson_cdf(cdf);
+    uint8_t* is_test = malloc(chunk->stride);
+    int* in_batch = malloc(rf->n_trees * sizeof(int));
+
+    int n_frontier = rf->n_trees;
+    StreamSlot* frontier = malloc(n_frontier * sizeof(StreamSlot));
+    for (int t = 0; t < rf->n_trees; t++) frontier[t] = (StreamSlot){t, 0};
+
+    int status = 0;
+    params->n_passes = 1;   // The scan
+    for (int depth = 0; depth < max_depth && n_frontier > 0 && status == 0; depth++) {
+        size_t used_bytes = chunk_bytes;
+        for (int t = 0; t < rf->n_trees; t++) {
+            used_bytes += (size_t)rf->trees[t].capacity * (sizeof(TreeNode) + sizeof(int));
+        }
+        if (used_bytes + slot_bytes > params->memory_limit) {
+            fprintf(stderr, "Error: a memory limit of %.1f MB is too small: chunks and trees need "
+                    "%.1f MB and each node histogram %.3f MB\n", params->memory_limit / 1048576.0,
+                    used_bytes / 1048576.0, slot_bytes / 1048576.0);
+            status = -1;
+            break;
+        }
+        size_t budget_slots = (params->memory_limit - used_bytes) / slot_bytes;
+        int max_slots = budget_slots < (size_t)n_frontier ? (int)budget_slots : n_frontier;
+
+        StreamSlot* next = malloc(2 * (size_t)n_frontier * sizeof(StreamSlot));
+        int n_next = 0;
+        int level_passes = 0;
+
+        for (int first = 0; first < n_frontier && status == 0; first += max_slots) {
+            int n_slots = n_frontier - first < max_slots ? n_frontier - first : max_slots;
+            StreamSlot* batch = &frontier[first];
+            int64_t* hist = calloc((size_t)n_slots * slot_ints, sizeof(int64_t));
+
+            // Frontier nodes of this batch map to their histogram slot
+            memset(in_batch, 0, rf->n_trees * sizeof(int));
+            for (int s = 0; s < n_slots; s++) {
+                DecisionTree* tree = &rf->trees[batch[s].tree];
+                if (!in_batch[batch[s].tree]) {
+                    slot_of[batch[s].tree] = realloc(slot_of[batch[s].tree],
+                                                     tree->n_nodes * sizeof(int));
+                    for (int i = 0; i < tree->n_nodes; i++) slot_of[batch[s].tree][i] = -1;
+                    in_batch[batch[s].tree] = 1;
+                }
+                slot_of[batch[s].tree][batch[s].node] = s;
+            }
+
+            // One pass over the data fills the batch's histograms
+            rewind_stream(&stream);
+            int n_rows;
+            while ((n_rows = read_chunk(&stream, chunk)) > 0) {
+                long long first_row = stream.next_row - n_rows;
+                for (int i = 0; i < n_rows; i++) {
+                    is_test[i] = (uint8_t)is_test_row(&split, params->train_ratio, first_row + i);
+                }
+                #ifdef _OPENMP
+                #pragma omp parallel for schedule(static)
+                #endif
+                for (int f = 0; f < n_features; f++) {
+                    const double* values = &chunk->features[(size_t)f * chunk->stride];
+                    uint8_t* column = &codes[(size_t)f * chunk->stride];
+                    for (int i = 0; i < n_rows; i++) {
+                        column[i] = (uint8_t)find_bin(bins, f, values[i]);
+                    }
+                }
+
+                // Trees own disjoint slots, so they update without locks
+                #ifdef _OPENMP
+                #pragma omp parallel for schedule(dynamic)
+                #endif
+                for (int t = 0; t < rf->n_trees; t++) {
+                    if (!in_batch[t]) continue;
+                    TreeNode* nodes = rf->trees[t].nodes;
+                    for (int i = 0; i < n_rows; i++) {
+                        if (is_test[i]) continue;
+                        int weight = poisson_weight(cdf, &weights[t], first_row + i);
+                        if (weight == 0) continue;
+
+                        int node = 0;
+                        while (!nodes[node].is_leaf) {
+                            double value = chunk->features[(size_t)nodes[node].feature_index *
+                                                           chunk->stride + i];
+                            node = value <= nodes[node].threshold ? nodes[node].left_child
+                                                                  : nodes[node].right_child;
+                        }
+                        int s = slot_of[t][node];
+                        if (s < 0) continue;
+
+                        int64_t* slot = &hist[(size_t)s * slot_ints];
+                        int label = chunk->labels[i];
+                        for (int k = 0; k < rf->n_features_per_tree; k++) {
+                            int bin = codes[(size_t)features[t][k] * chunk->stride + i];
+                            slot[k * feature_stride + bin * n_classes + label] += weight;
+                        }
+                    }
+                }
+            }
+            if (n_rows < 0) status = -1;
+            level_passes++;
+
+            for (int s = 0; s < n_slots && status == 0; s++) {
+                split_stream_node(rf, bins, features, n_classes, &hist[(size_t)s * slot_ints],
+                                  feature_stride, batch[s], depth, root_weight, next, &n_next);
+            }
+            free(hist);
+        }
+
+        printf("  Level %d: %d nodes in %d pass%s\n", depth, n_frontier, level_passes,
+               level_passes == 1 ? "" : "es");
+        params->n_passes += level_passes;
+        free(frontier);
+        frontier = next;
+        n_frontier = n_next;
+    }
+    free(frontier);
+
+    long total_nodes = 0;
+    for (int t = 0; t < rf->n_trees; t++) {
+        freeze_tree(&rf->trees[t]);
+        total_nodes += rf->trees[t].n_nodes;
+        free(features[t]);
+        free(slot_of[t]);
+    }
+    finalize_forest(rf, n_features);
+    if (status == 0) printf("Streamed %d passes over %s, %ld nodes in %d trees\n", params->n_passes, filename,
+           total_nodes, rf->n_trees);
+
+    free(features);
+    free(slot_of);
+    free(root_weight);
+    free(weights);
+    free(in_batch);
+    free(is_test);
+    free(codes);
+    free_dataset(chunk);
+    close_stream(&stream);
+    return status;
+}
+
+// Accuracy of rf on the rows of filename that the split hash assigns to the
+// test set, read chunk by chunk
+double evaluate_streaming_accuracy(RandomForest* rf, const char* filename, StreamParams* params) {
+    DataStream stream;
+    if (!open_stream(&stream, filename)) return 0.0;
+    Dataset* chunk = create_dataset(stream_chunk_rows(params, stream.n_features), stream.n_features);
+
+    RandomStream split = random_stream(params->seed, STREAM_SPLIT_ID);
+    long long correct = 0, tested = 0;
+    int n_rows;
+    while ((n_rows = read_chunk(&stream, chunk)) > 0) {
+        long long first_row = stream.next_row - n_rows;
+
+        int n_blocks = (n_rows + PREDICT_BLOCK_SAMPLES - 1) / PREDICT_BLOCK_SAMPLES;
+
+        #ifdef _OPENMP
+        #pragma omp parallel
+        #endif
+        {
+            // Test rows of each block are gathered into rows and scored together
+            double* rows = malloc((size_t)PREDICT_BLOCK_SAMPLES * chunk->n_features * sizeof(double));
+            int* votes = malloc((size_t)PREDICT_BLOCK_SAMPLES * rf->n_classes * sizeof(int));
+            int labels[PREDICT_BLOCK_SAMPLES];
+            int predictions[PREDICT_BLOCK_SAMPLES];
+
+            #ifdef _OPENMP
+            #pragma omp for schedule(dynamic) reduction(+:correct, tested)
+            #endif
+            for (int b = 0; b < n_blocks; b++) {
+                int end = (b + 1) * PREDICT_BLOCK_SAMPLES < n_rows ? (b + 1) * PREDICT_BLOCK_SAMPLES : n_rows;
+                int count = 0;
+                for (int i = b * PREDICT_BLOCK_SAMPLES; i < end; i++) {
+                    if (!is_test_row(&split, params->train_ratio, first_row + i)) continue;
+                    get_sample(chunk, i, &rows[(size_t)count * chunk->n_features]);
+                    labels[count++] = chunk->labels[i];
+                }
+                predict_forest_block(rf, rows, count, votes, predictions);
+                for (int s = 0; s < count; s++) {
+                    correct += predictions[s] == labels[s];
+                }
+                tested += count;
+            }
+
+            free(rows);
+            free(votes);
+        }
+    }
+
+    printf("Evaluated %lld streamed test samples\n", tested);
+    free_dataset(chunk);
+    close_stream(&stream);
+    return tested > 0 ? (double)correct / tested : 0.0;
+}
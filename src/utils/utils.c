@@ -1,4 +1,6 @@
+#define _POSIX_C_SOURCE 200112L  // posix_memalign
 #include "random_forest.h"
+#include <sys/resource.h>
 
 double get_time_diff(struct timeval start, struct timeval end) {
     return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
@@ -6,14 +8,16 @@ double get_time_diff(struct timeval start, struct timeval end) {
 
 void print_performance_metrics(PerformanceMetrics* metrics, const char* dataset_name) {
     printf("Performance Results for %s:\n", dataset_name);
+    printf("  Load Time: %.4f seconds (%.1f MB/s)\n", metrics->load_time, metrics->load_mb_per_s);
     printf("  Execution Time: %.4f seconds\n", metrics->execution_time);
     printf("  Accuracy: %.2f%%\n", metrics->accuracy * 100.0);
     printf("  Trees Used: %d\n", metrics->n_trees_used);
     printf("  Threads Used: %d\n", metrics->n_threads_used);
+    printf("  Peak RSS: %.1f MB\n", metrics->peak_rss_mb);
     printf("---\n");
 }
 
-int* generate_random_features(int n_total_features, int n_selected_features) {
+int* generate_random_features(int n_total_features, int n_selected_features, RandomStream* rng) {
     if (n_selected_features > n_total_features) {
         n_selected_features = n_total_features;
     }
@@ -28,7 +32,7 @@ int* generate_random_features(int n_total_features, int n_selected_features) {
     
     // Randomly select features without replacement
     for (int i = 0; i < n_selected_features; i++) {
-        int random_idx = rand() % (n_total_features - i);
+        int random_idx = (int)random_below(rng, n_total_features - i);
         selected_features[i] = available_features[random_idx];
         
         // Move selected feature to end and reduce available count
@@ -72,70 +76,119 @@ int get_majority_class(int* predictions, int n_predictions) {
     return majority_class;
 }
 
-void merge(double* arr, int left, int mid, int right) {
-    int i, j, k;
-    int n1 = mid - left + 1;
-    int n2 = right - mid;
-    
-    // Create temporary arrays
-    double* left_arr = malloc(n1 * sizeof(double));
-    double* right_arr = malloc(n2 * sizeof(double));
-    
-    // Copy data to temporary arrays
-    for (i = 0; i < n1; i++)
-        left_arr[i] = arr[left + i];
-    for (j = 0; j < n2; j++)
-        right_arr[j] = arr[mid + 1 + j];
-    
-    // Merge the temporary arrays back into arr[left..right]
-    i = 0; // Initial index of first subarray
-    j = 0; // Initial index of second subarray
-    k = left; // Initial index of merged subarray
-    
-    while (i < n1 && j < n2) {
-        if (left_arr[i] <= right_arr[j]) {
-            arr[k] = left_arr[i];
-            i++;
+void merge(double* arr, double* tmp, int left, int mid, int right) {
+    int i = left;    // Initial index of first subarray
+    int j = mid + 1; // Initial index of second subarray
+    int k = 0;       // Initial index of merged subarray
+    
+    // Merge both halves into the shared temporary buffer
+    while (i <= mid && j <= right) {
+        if (arr[i] <= arr[j]) {
+            tmp[k++] = arr[i++];
         } else {
-            arr[k] = right_arr[j];
-            j++;
+            tmp[k++] = arr[j++];
         }
-        k++;
     }
     
-    // Copy the remaining elements of left_arr[], if any
-    while (i < n1) {
-        arr[k] = left_arr[i];
-        i++;
-        k++;
+    // Copy the remaining elements of either half, if any
+    while (i <= mid) {
+        tmp[k++] = arr[i++];
     }
-    
-    // Copy the remaining elements of right_arr[], if any
-    while (j < n2) {
-        arr[k] = right_arr[j];
-        j++;
-        k++;
+    while (j <= right) {
+        tmp[k++] = arr[j++];
     }
     
-    free(left_arr);
-    free(right_arr);
+    memcpy(&arr[left], tmp, k * sizeof(double));
 }
 
-void merge_sort_helper(double* arr, int left, int right) {
+void merge_sort_helper(double* arr, double* tmp, int left, int right) {
     if (left < right) {
         int mid = left + (right - left) / 2;
         
         // Recursively sort first and second halves
-        merge_sort_helper(arr, left, mid);
-        merge_sort_helper(arr, mid + 1, right);
+        merge_sort_helper(arr, tmp, left, mid);
+        merge_sort_helper(arr, tmp, mid + 1, right);
         
         // Merge the sorted halves
-        merge(arr, left, mid, right);
+        merge(arr, tmp, left, mid, right);
     }
 }
 
 void merge_sort(double* arr, int n) {
     if (n > 1) {
-        merge_sort_helper(arr, 0, n - 1);
+        // One temporary buffer serves every merge
+        double* tmp = malloc(n * sizeof(double));
+        merge_sort_helper(arr, tmp, 0, n - 1);
+        free(tmp);
+    }
+}
+
+void merge_by_key(double* keys, int* values, double* key_tmp, int* value_tmp,
+                  int left, int mid, int right) {
+    int i = left, j = mid + 1, k = 0;
+    
+    // Stable merge: ties keep the element from the left half first
+    while (i <= mid && j <= right) {
+        if (keys[i] <= keys[j]) {
+            key_tmp[k] = keys[i];
+            value_tmp[k++] = values[i++];
+        } else {
+            key_tmp[k] = keys[j];
+            value_tmp[k++] = values[j++];
+        }
+    }
+    while (i <= mid) {
+        key_tmp[k] = keys[i];
+        value_tmp[k++] = values[i++];
+    }
+    while (j <= right) {
+        key_tmp[k] = keys[j];
+        value_tmp[k++] = values[j++];
+    }
+    
+    memcpy(&keys[left], key_tmp, k * sizeof(double));
+    memcpy(&values[left], value_tmp, k * sizeof(int));
+}
+
+void merge_sort_by_key_helper(double* keys, int* values, double* key_tmp, int* value_tmp,
+                              int left, int right) {
+    if (left < right) {
+        int mid = left + (right - left) / 2;
+        
+        merge_sort_by_key_helper(keys, values, key_tmp, value_tmp, left, mid);
+        merge_sort_by_key_helper(keys, values, key_tmp, value_tmp, mid + 1, right);
+        
+        merge_by_key(keys, values, key_tmp, value_tmp, left, mid, right);
     }
 }
+
+// Sorts keys ascending and applies the same permutation to values. The
+// temporary buffers come from the arena and are shared by every merge.
+void merge_sort_by_key(double* keys, int* values, int n, ScratchArena* arena) {
+    if (n <= 1) return;
+    
+    size_t mark = arena_mark(arena);
+    double* key_tmp = arena_alloc(arena, n * sizeof(double));
+    int* value_tmp = arena_alloc(arena, n * sizeof(int));
+    
+    merge_sort_by_key_helper(keys, values, key_tmp, value_tmp, 0, n - 1);
+    
+    arena_release(arena, mark);
+}
+
+// Cache-line aligned allocation, released with free()
+void* malloc_aligned(size_t bytes) {
+    void* ptr;
+    if (posix_memalign(&ptr, CACHE_LINE, bytes > 0 ? bytes : CACHE_LINE) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        abort();
+    }
+    return ptr;
+}
+
+// Largest resident set of the process so far (Linux reports ru_maxrss in KB)
+double get_peak_rss_mb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return usage.ru_maxrss / 1024.0;
+}